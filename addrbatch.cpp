@@ -0,0 +1,460 @@
+/*
+A multicast interface to the socket library
+
+  Bulk IPv4 text conversion
+
+    Arrays of dotted quads to binary addresses and back, with SIMD
+    kernels chosen at run time. See addrbatch.h
+
+    Parsing: the '.' and digit masks of the (up to 15 byte) text give the
+    length of each part. A table indexed by the four lengths (81 entries)
+    holds the shuffle that moves the digits of each part into a 32 bit
+    lane, right aligned, and the smallest value of that many digits. Two
+    multiply-adds make the values, which are checked against 255 and the
+    smallest value (this rejects leading zeros)
+
+    Formatting: the hundreds, tens and ones of the four bytes are computed
+    at once with multiplications by reciprocals, and a table indexed by
+    the number of digits of each byte gives the shuffle that drops the
+    leading zeros and puts the dots in
+
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "addrbatch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BATCH_SIMD 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+#define BATCH_ENTRIES  81          // 3 lengths (1 to 3 digits) of 4 parts
+#define BATCH_PAGE     4096        // smallest page size
+
+//////////// scalar kernels
+//
+static bool parse_quad(const char* p, unsigned char* bytes) {
+
+  for (int i=0; i<4; i++) {
+    unsigned value  = 0;
+    int      digits = 0;
+
+    for (; *p >= '0' and *p <= '9'; p++) {
+      if (digits == 1 and value == 0)          // no leading zeros
+        return false;
+      value = value * 10 + (*p - '0');
+      if (++digits > 3 or value > 255)
+        return false;
+    }
+    if (digits == 0)
+      return false;
+    bytes[i] = value;
+
+    if (i < 3 and *p++ != '.')
+      return false;
+  }
+
+  return *p == '\0';
+}
+
+static size_t parse_scalar(const char* const* texts, size_t count,
+                           struct in_addr* addrs, bool* valid) {
+  size_t n = 0;
+
+  for (size_t i=0; i<count; i++) {
+    unsigned char bytes[4];
+    valid[i] = parse_quad(texts[i], bytes);
+    if (valid[i])
+      memcpy(&addrs[i].s_addr, bytes, sizeof(bytes));
+    else
+      addrs[i].s_addr = 0;
+    n += valid[i];
+  }
+
+  return n;
+}
+
+static void format_scalar(const struct in_addr* addrs, size_t count,
+                          char (*texts)[INET_ADDRSTRLEN]) {
+
+  for (size_t i=0; i<count; i++) {
+    auto  bytes = (const unsigned char*) &addrs[i].s_addr;
+    char* p     = texts[i];
+
+    for (int j=0; j<4; j++) {
+      unsigned int b = bytes[j];
+      if (b >= 100) {
+        *p++ = '0' + b / 100;
+        b %= 100;
+        *p++ = '0' + b / 10;
+      }
+      else if (b >= 10)
+        *p++ = '0' + b / 10;
+      *p++ = '0' + b % 10;
+      if (j < 3)
+        *p++ = '.';
+    }
+    *p = '\0';
+  }
+}
+
+#ifdef BATCH_SIMD
+//////////// tables
+//
+typedef struct {
+  unsigned char shuffle[16];       // digits of part i to lane i, right aligned
+  int32_t       lowest[4];         // smallest value of part i, less 1
+} parse_entry_t;
+
+typedef struct {
+  parse_entry_t parse[BATCH_ENTRIES];
+  unsigned char format[BATCH_ENTRIES][16];  // hundreds, tens, ones to text
+  unsigned char digits[256];       // digits of a byte, less 1
+} batch_tables_t;
+
+// entry of parts of 'len0' ... 'len3' digits (1 to 3)
+static inline int table_entry(unsigned len0, unsigned len1, unsigned len2,
+                              unsigned len3) {
+  return (len0 - 1) * 27 + (len1 - 1) * 9 + (len2 - 1) * 3 + (len3 - 1);
+}
+
+static batch_tables_t build_tables() {
+  batch_tables_t t;
+
+  for (int e=0; e<BATCH_ENTRIES; e++) {
+    int lens[4] = { e / 27 + 1, e / 9 % 3 + 1, e / 3 % 3 + 1, e % 3 + 1 };
+    parse_entry_t& pe  = t.parse[e];
+    unsigned char* fmt = t.format[e];
+    int start = 0;                           // of the part in the text
+    int out   = 0;
+
+    memset(fmt, 0x80, 16);                   // 0x80: a zero byte (NUL)
+    for (int i=0; i<4; i++) {
+      int len = lens[i];
+      // k: hundreds, tens, ones. Formatting takes them from bytes
+      // i, 4 + i and 8 + i, dots from byte 12
+      for (int k=0; k<3; k++) {
+        int pos = start + len - 3 + k;
+        pe.shuffle[4 * i + k] = pos >= start ? pos : 0x80;
+        if (k >= 3 - len)
+          fmt[out++] = 4 * k + i;
+      }
+      pe.shuffle[4 * i + 3] = 0x80;
+      pe.lowest[i] = (len == 1 ? 0 : len == 2 ? 10 : 100) - 1;
+      if (i < 3)
+        fmt[out++] = 12;
+      start += len + 1;
+    }
+  }
+  for (int b=0; b<256; b++)
+    t.digits[b] = (b >= 10) + (b >= 100);
+
+  return t;
+}
+
+static const batch_tables_t& tables() {
+  static const batch_tables_t t = build_tables();
+  return t;
+}
+
+// Table entry of a text from its NUL, '.' and digit masks (bit i: byte i
+// of its first 16). -1 if it is no dotted quad
+static inline int quad_entry(unsigned nuls, unsigned dots, unsigned digits) {
+  unsigned len = __builtin_ctz(nuls | 0x10000);
+
+  if (len > 15)
+    return -1;
+  unsigned used = (1u << len) - 1;
+  dots &= used;
+  if (((dots | digits) & used) != used or __builtin_popcount(dots) != 3)
+    return -1;
+
+  unsigned dot0 = __builtin_ctz(dots);
+  dots &= dots - 1;
+  unsigned dot1 = __builtin_ctz(dots);
+  dots &= dots - 1;
+  unsigned dot2 = __builtin_ctz(dots);
+
+  unsigned len0 = dot0;
+  unsigned len1 = dot1 - dot0 - 1;
+  unsigned len2 = dot2 - dot1 - 1;
+  unsigned len3 = len - dot2 - 1;
+  if (len0 - 1 > 2 or len1 - 1 > 2 or len2 - 1 > 2 or len3 - 1 > 2)
+    return -1;                               // empty or over 3 digits
+
+  return table_entry(len0, len1, len2, len3);
+}
+
+//////////// SSE4.1 kernels
+//
+// First 16 bytes of 'text'. Bytes past its NUL are garbage. Reading past
+// the end is only done within a page, where it cannot fault
+__attribute__((target("sse4.1")))
+static inline __m128i load_text(const char* text) {
+
+  if (((uintptr_t) text & (BATCH_PAGE - 1)) <= BATCH_PAGE - 16)
+    return _mm_loadu_si128((const __m128i*) text);
+
+  char buf[16] = {};
+  memcpy(buf, text, strnlen(text, sizeof(buf)));
+  return _mm_loadu_si128((const __m128i*) buf);
+}
+
+__attribute__((target("sse4.1")))
+static inline int format_entry(const batch_tables_t& t, uint32_t addr) {
+  auto bytes = (const unsigned char*) &addr;
+
+  return t.digits[bytes[0]] * 27 + t.digits[bytes[1]] * 9 +
+         t.digits[bytes[2]] * 3  + t.digits[bytes[3]];
+}
+
+__attribute__((target("sse4.1")))
+static size_t parse_sse4(const char* const* texts, size_t count,
+                         struct in_addr* addrs, bool* valid) {
+  const batch_tables_t& t = tables();
+  const __m128i zero    = _mm_setzero_si128();
+  const __m128i dot     = _mm_set1_epi8('.');
+  const __m128i ascii0  = _mm_set1_epi8('0');
+  const __m128i nine    = _mm_set1_epi8(9);
+  const __m128i weights = _mm_setr_epi8(100, 10, 1, 0, 100, 10, 1, 0,
+                                        100, 10, 1, 0, 100, 10, 1, 0);
+  const __m128i ones    = _mm_set1_epi16(1);
+  const __m128i above   = _mm_set1_epi32(256);
+  const __m128i pack    = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+                                        -1, -1, -1, -1, -1, -1, -1, -1);
+  size_t n = 0;
+
+  for (size_t i=0; i<count; i++) {
+    __m128i v = load_text(texts[i]);
+    __m128i d = _mm_sub_epi8(v, ascii0);
+    int     e = quad_entry(
+                  _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)),
+                  _mm_movemask_epi8(_mm_cmpeq_epi8(v, dot)),
+                  _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, nine), d)));
+    bool    ok   = false;
+    int32_t addr = 0;
+
+    if (e >= 0) {
+      const parse_entry_t& pe = t.parse[e];
+      __m128i x = _mm_shuffle_epi8(d,
+                    _mm_loadu_si128((const __m128i*) pe.shuffle));
+      x = _mm_madd_epi16(_mm_maddubs_epi16(x, weights), ones);
+      __m128i in_range = _mm_and_si128(
+              _mm_cmpgt_epi32(x, _mm_loadu_si128((const __m128i*) pe.lowest)),
+              _mm_cmpgt_epi32(above, x));
+      if (_mm_movemask_epi8(in_range) == 0xffff) {
+        addr = _mm_cvtsi128_si32(_mm_shuffle_epi8(x, pack));
+        ok   = true;
+      }
+    }
+    addrs[i].s_addr = addr;
+    valid[i]        = ok;
+    n += ok;
+  }
+
+  return n;
+}
+
+__attribute__((target("sse4.1")))
+static void format_sse4(const struct in_addr* addrs, size_t count,
+                        char (*texts)[INET_ADDRSTRLEN]) {
+  const batch_tables_t& t = tables();
+  const __m128i by100  = _mm_set1_epi16(656);    // x * 656 >> 16 == x / 100
+  const __m128i by10   = _mm_set1_epi16(6554);   // x * 6554 >> 16 == x / 10
+  const __m128i hundred = _mm_set1_epi16(100);
+  const __m128i ten    = _mm_set1_epi16(10);
+  const __m128i ascii  = _mm_setr_epi8('0', '0', '0', '0', '0', '0', '0', '0',
+                                       '0', '0', '0', '0', '.', 0, 0, 0);
+
+  for (size_t i=0; i<count; i++) {
+    uint32_t addr = addrs[i].s_addr;
+    __m128i  x    = _mm_cvtepu8_epi16(_mm_cvtsi32_si128(addr));
+    __m128i  h    = _mm_mulhi_epu16(x, by100);
+    __m128i  r    = _mm_sub_epi16(x, _mm_mullo_epi16(h, hundred));
+    __m128i  tens = _mm_mulhi_epu16(r, by10);
+    __m128i  o    = _mm_sub_epi16(r, _mm_mullo_epi16(tens, ten));
+    // hundreds in bytes 0-3, tens in 4-7, ones in 8-11, '.' in 12
+    __m128i  text = _mm_add_epi8(
+                      _mm_packus_epi16(_mm_unpacklo_epi64(h, tens), o), ascii);
+
+    const unsigned char* fmt = t.format[format_entry(t, addr)];
+    text = _mm_shuffle_epi8(text, _mm_loadu_si128((const __m128i*) fmt));
+    _mm_storeu_si128((__m128i*) texts[i], text);
+  }
+}
+
+//////////// AVX2 kernels: two addresses at a time, one per 128 bit lane
+//
+__attribute__((target("avx2")))
+static inline __m256i load_pair(const void* p0, const void* p1) {
+  return _mm256_inserti128_si256(
+           _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) p0)),
+           _mm_loadu_si128((const __m128i*) p1), 1);
+}
+
+__attribute__((target("avx2")))
+static size_t parse_avx2(const char* const* texts, size_t count,
+                         struct in_addr* addrs, bool* valid) {
+  const batch_tables_t& t = tables();
+  const __m256i zero    = _mm256_setzero_si256();
+  const __m256i dot     = _mm256_set1_epi8('.');
+  const __m256i ascii0  = _mm256_set1_epi8('0');
+  const __m256i nine    = _mm256_set1_epi8(9);
+  const __m256i weights = _mm256_setr_epi8(100, 10, 1, 0, 100, 10, 1, 0,
+                                           100, 10, 1, 0, 100, 10, 1, 0,
+                                           100, 10, 1, 0, 100, 10, 1, 0,
+                                           100, 10, 1, 0, 100, 10, 1, 0);
+  const __m256i ones    = _mm256_set1_epi16(1);
+  const __m256i above   = _mm256_set1_epi32(256);
+  const __m256i pack    = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+                                           -1, -1, -1, -1, -1, -1, -1, -1,
+                                           0, 4, 8, 12, -1, -1, -1, -1,
+                                           -1, -1, -1, -1, -1, -1, -1, -1);
+  size_t n = 0;
+  size_t i = 0;
+
+  for (; i + 2 <= count; i += 2) {
+    __m128i  v0 = load_text(texts[i]);
+    __m128i  v1 = load_text(texts[i + 1]);
+    __m256i  v  = _mm256_inserti128_si256(_mm256_castsi128_si256(v0), v1, 1);
+    __m256i  d  = _mm256_sub_epi8(v, ascii0);
+    uint32_t nuls   = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero));
+    uint32_t dots   = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, dot));
+    uint32_t digits = _mm256_movemask_epi8(
+                        _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d));
+    int      e0 = quad_entry(nuls & 0xffff, dots & 0xffff, digits & 0xffff);
+    int      e1 = quad_entry(nuls >> 16, dots >> 16, digits >> 16);
+    // invalid texts go through entry 0 and are discarded
+    const parse_entry_t& pe0 = t.parse[e0 < 0 ? 0 : e0];
+    const parse_entry_t& pe1 = t.parse[e1 < 0 ? 0 : e1];
+
+    __m256i x = _mm256_shuffle_epi8(d, load_pair(pe0.shuffle, pe1.shuffle));
+    x = _mm256_madd_epi16(_mm256_maddubs_epi16(x, weights), ones);
+    __m256i in_range = _mm256_and_si256(
+                         _mm256_cmpgt_epi32(x, load_pair(pe0.lowest,
+                                                         pe1.lowest)),
+                         _mm256_cmpgt_epi32(above, x));
+    uint32_t ranges = _mm256_movemask_epi8(in_range);
+    x = _mm256_shuffle_epi8(x, pack);
+
+    bool ok0 = e0 >= 0 and (ranges & 0xffff) == 0xffff;
+    bool ok1 = e1 >= 0 and (ranges >> 16) == 0xffff;
+    addrs[i].s_addr     = ok0 ? _mm256_extract_epi32(x, 0) : 0;
+    addrs[i + 1].s_addr = ok1 ? _mm256_extract_epi32(x, 4) : 0;
+    valid[i]     = ok0;
+    valid[i + 1] = ok1;
+    n += ok0 + ok1;
+  }
+
+  return n + parse_sse4(texts + i, count - i, addrs + i, valid + i);
+}
+
+__attribute__((target("avx2")))
+static void format_avx2(const struct in_addr* addrs, size_t count,
+                        char (*texts)[INET_ADDRSTRLEN]) {
+  const batch_tables_t& t = tables();
+  const __m256i by100   = _mm256_set1_epi16(656);
+  const __m256i by10    = _mm256_set1_epi16(6554);
+  const __m256i hundred = _mm256_set1_epi16(100);
+  const __m256i ten     = _mm256_set1_epi16(10);
+  const __m256i ascii   = _mm256_setr_epi8(
+                            '0', '0', '0', '0', '0', '0', '0', '0',
+                            '0', '0', '0', '0', '.', 0, 0, 0,
+                            '0', '0', '0', '0', '0', '0', '0', '0',
+                            '0', '0', '0', '0', '.', 0, 0, 0);
+  size_t i = 0;
+
+  for (; i + 2 <= count; i += 2) {
+    uint32_t addr0 = addrs[i].s_addr;
+    uint32_t addr1 = addrs[i + 1].s_addr;
+    // bytes of 'addr0' to the low lane, those of 'addr1' to the high one
+    __m256i x    = _mm256_cvtepu8_epi16(_mm_set_epi32(0, addr1, 0, addr0));
+    __m256i h    = _mm256_mulhi_epu16(x, by100);
+    __m256i r    = _mm256_sub_epi16(x, _mm256_mullo_epi16(h, hundred));
+    __m256i tens = _mm256_mulhi_epu16(r, by10);
+    __m256i o    = _mm256_sub_epi16(r, _mm256_mullo_epi16(tens, ten));
+    __m256i text = _mm256_add_epi8(
+                     _mm256_packus_epi16(_mm256_unpacklo_epi64(h, tens), o),
+                     ascii);
+
+    text = _mm256_shuffle_epi8(text,
+             load_pair(t.format[format_entry(t, addr0)],
+                       t.format[format_entry(t, addr1)]));
+    _mm_storeu_si128((__m128i*) texts[i], _mm256_castsi256_si128(text));
+    _mm_storeu_si128((__m128i*) texts[i + 1],
+                     _mm256_extracti128_si256(text, 1));
+  }
+
+  format_sse4(addrs + i, count - i, texts + i);
+}
+#endif
+
+//////////// dispatch
+//
+static atomic<int> kernel(-1);
+
+static bool supported(int k) {
+
+  switch (k) {
+    case BATCH_SCALAR: return true;
+#ifdef BATCH_SIMD
+    case BATCH_SSE4:   return __builtin_cpu_supports("sse4.1");
+    case BATCH_AVX2:   return __builtin_cpu_supports("avx2");
+#endif
+  }
+
+  return false;
+}
+
+int get_batch_kernel() {
+  int k = kernel.load(memory_order_relaxed);
+
+  if (k < 0) {
+    k = supported(BATCH_AVX2) ? BATCH_AVX2 :
+        supported(BATCH_SSE4) ? BATCH_SSE4 : BATCH_SCALAR;
+    kernel.store(k, memory_order_relaxed);
+  }
+
+  return k;
+}
+
+bool set_batch_kernel(int k) {
+
+  if (not supported(k))
+    return false;
+  kernel.store(k, memory_order_relaxed);
+
+  return true;
+}
+
+size_t parse_ipv4_batch(const char* const* texts, size_t count,
+                        struct in_addr* addrs, bool* valid) {
+
+  switch (get_batch_kernel()) {
+#ifdef BATCH_SIMD
+    case BATCH_AVX2: return parse_avx2(texts, count, addrs, valid);
+    case BATCH_SSE4: return parse_sse4(texts, count, addrs, valid);
+#endif
+    default:         return parse_scalar(texts, count, addrs, valid);
+  }
+}
+
+void format_ipv4_batch(const struct in_addr* addrs, size_t count,
+                       char (*texts)[INET_ADDRSTRLEN]) {
+
+  switch (get_batch_kernel()) {
+#ifdef BATCH_SIMD
+    case BATCH_AVX2: format_avx2(addrs, count, texts);
+                     break;
+    case BATCH_SSE4: format_sse4(addrs, count, texts);
+                     break;
+#endif
+    default:         format_scalar(addrs, count, texts);
+  }
+}
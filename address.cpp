@@ -21,13 +21,17 @@ A multicast interface to the socket library
 
 // C++ includes
 #include <iostream>
+#include <type_traits>
 #include <string>
 #include <cstring>
+#include <algorithm>
 #include <map>
+#include <mutex>
 
 // local includes
 #include "address.h"
 #include "logging.h"
+#include "monoclock.h"
 
 using namespace std;
 
@@ -41,257 +45,763 @@ static std::map<int, std::string> family_map = { {AF_LOCAL_L2, "link layer"},
                                                  {AF_INET,     "IPv4"},
                                                  {AF_INET6,    "IPv6"} };
 
-// Address union packs together the address variants we use in each case
-// Constructors
-Addrunion::Addrunion(struct in_addr  addr) : in(addr)  {}
-Addrunion::Addrunion(struct in6_addr addr) : in6(addr) {}
-Addrunion::Addrunion(struct mac_addr addr) : mac(addr) {}
-
-//// Address base class. Constructor and methods
+//// Address values
 //
-Address::Address(struct in_addr addr)  : address(addr), family(AF_INET),     host("")  {}
-Address::Address(struct in6_addr addr) : address(addr), family(AF_INET6),    host("")  {}
-Address::Address(struct mac_addr addr) : address(addr), family(AF_LOCAL_L2), host("")  {}
+static_assert(sizeof(AddressValue) == 24, "address values take 24 bytes");
+static_assert(std::is_trivially_copyable<AddressValue>::value,
+              "address values are copied as bytes");
 
-// Destructor
-Address::~Address() {}
+AddressValue::AddressValue() : scope_id(0), family(AF_UNSPEC) {
+  memset(&addr, 0, sizeof(addr));
+}
 
-sa_family_t Address::get_family() const {
-  return family;
+AddressValue::AddressValue(struct in_addr a) : scope_id(0), family(AF_INET) {
+  memset(&addr, 0, sizeof(addr));
+  addr.in = a;
 }
 
-// These are virtual functions to be overriden in derived classes
-//
-bool Address::operator==(const Address& other) const {
-  cout << "comparing gets at Address base" << endl;
-  return false;
+AddressValue::AddressValue(struct in6_addr a, uint32_t sid) :
+                             scope_id(sid), family(AF_INET6) {
+  addr.in6 = a;
 }
 
-bool Address::is_multicast() {
-  return false;
+AddressValue::AddressValue(struct mac_addr a) : scope_id(0),
+                                                family(AF_LOCAL_L2) {
+  memset(&addr, 0, sizeof(addr));
+  addr.mac = a;
 }
 
-string Address::print() {
-  return host;
+AddressValue AddressValue::from_sockaddr(const struct sockaddr* sa) {
+
+  if (sa and sa->sa_family == AF_INET)
+    return AddressValue(((const struct sockaddr_in*) sa)->sin_addr);
+
+  if (sa and sa->sa_family == AF_INET6) {
+    auto sin6 = (const struct sockaddr_in6*) sa;
+    return AddressValue(sin6->sin6_addr, sin6->sin6_scope_id);
+  }
+
+  return AddressValue();
 }
 
-void* Address::get_binaddr() const {
-  return nullptr;
+const void* AddressValue::get_binaddr() const {
+  return family == AF_UNSPEC ? nullptr : &addr;
 }
 
-////////   IPv4Address is a derived class from Address
-//
-// Constructor takes the binary form of the address and generates a
-// canonical form of the textual representation
-// This is required because user-provided text addresses may be incomplete
-// or ambiguous (e.g  '::', '192.1', '1:2:3:a:b:c') 
-//
-IPv4Address::IPv4Address(struct in_addr addr) : Address(addr) {
-  char buff[64];
+unsigned int AddressValue::get_scope() const {
 
-  if (inet_ntop(AF_INET, &address.in, buff, sizeof(buff))) {
-    host = string(buff);
-    ipv4mapped = "::ffff:" + host;
-  }
-  else {
-    logger->critical("Invalid address for family AF_INET");
-    throw("Configured address has no textual representation. Aborting");
+  if (family != AF_INET6 or IN6_IS_ADDR_UNSPECIFIED(&addr.in6))
+    return SCP_INVSCOPE;
+
+  if (IN6_IS_ADDR_LOOPBACK(&addr.in6) or IN6_IS_ADDR_LINKLOCAL(&addr.in6))
+    return SCP_LINKLOCAL;
+
+  if IN6_IS_ADDR_MULTICAST(&addr.in6)
+    return (unsigned int) addr.in6.s6_addr[1] & 0x0f;
+
+  return SCP_GLOBAL;
+}
+
+bool AddressValue::is_v4mapped() const {
+  return family == AF_INET6 and IN6_IS_ADDR_V4MAPPED(&addr.in6);
+}
+
+bool AddressValue::is_multicast() const {
+
+  if (family == AF_INET)
+    return IN_MULTICAST(ntohl(addr.in.s_addr));
+
+  if (family != AF_INET6)
+    return false;
+
+  // a v4 mapped address is multicast if its v4 address is
+  if (IN6_IS_ADDR_V4MAPPED(&addr.in6)) {
+    in_addr_t v4addr;
+    memcpy(&v4addr, &addr.in6.s6_addr[12], sizeof(v4addr));
+    return IN_MULTICAST(ntohl(v4addr));
   }
+
+  return IN6_IS_ADDR_MULTICAST(&addr.in6);
 }
 
-// destructor
-IPv4Address::~IPv4Address() {}
+bool AddressValue::operator==(const AddressValue& other) const {
+  return family == other.family and
+         memcmp(addr.bytes, other.addr.bytes, sizeof(addr.bytes)) == 0;
+}
 
-void* IPv4Address::get_binaddr() const {
-  return (void *) &address.in;
+bool AddressValue::operator!=(const AddressValue& other) const {
+  return not (*this == other);
 }
 
-bool IPv4Address::operator==(const Address& other) const {
+bool AddressValue::operator<(const AddressValue& other) const {
 
-  cout << "comparing gets at IPv4 Address" << endl;
+  if (family != other.family)
+    return family < other.family;
 
-  auto inaddr = (struct in_addr*) other.get_binaddr();
+  return memcmp(addr.bytes, other.addr.bytes, sizeof(addr.bytes)) < 0;
+}
 
-  return (other.get_family() == AF_INET) and (inaddr->s_addr == address.in.s_addr);
+// Numeric address parsing
+//
+// One pass over the text, no allocation, no locale and no resolver
+//
+// digit values. -1 for anything else
+static const signed char hex_values[256] = {
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+static inline int hex_value(char c) {
+  return hex_values[(unsigned char) c];
 }
 
-bool IPv4Address::is_multicast() {
+static inline unsigned digit_value(char c) {
+  return (unsigned char) c - '0';                // > 9 for non digits
+}
+
+// strict dotted quad, as embedded in IPv6 addresses (RFC 4291 2.2): 1 to
+// 3 digits a byte, unrolled, no leading zeros. 'addr' is in host order,
+// built in a register: byte stores read back as a word would stall
+static bool parse_dotted_quad(const char* p, const char* end,
+                              uint32_t& addr) {
+  uint32_t quad = 0;
+
+  for (int i=0; i<4; i++) {
+    if (p == end or digit_value(*p) > 9)
+      return false;
+    unsigned value = digit_value(*p++);
+    if (p < end and digit_value(*p) <= 9) {
+      if (value == 0)
+        return false;
+      value = value * 10 + digit_value(*p++);
+      if (p < end and digit_value(*p) <= 9) {
+        value = value * 10 + digit_value(*p++);
+        if (value > 255)
+          return false;
+      }
+    }
+    quad = quad << 8 | value;
+
+    if (i < 3 and (p == end or *p++ != '.'))
+      return false;
+  }
 
-  return IN_MULTICAST(address.in.s_addr);
+  addr = quad;
+  return p == end;                               // a fourth digit fails here
 }
 
-////////   IPv6Address is a derived class from Address
-//
-IPv6Address::IPv6Address(struct in6_addr addr, int sid) :
-                Address(addr), scope_id(sid) {
-  char buff[64];
+// inet_aton() forms: 1 to 4 parts, each decimal, octal (leading 0) or
+// hexadecimal (leading 0x). The last part fills the remaining bytes
+static bool parse_ipv4(const char* p, const char* end, struct in_addr& in) {
+  uint32_t parts[4];
+  int      nparts = 0;
+  uint32_t quad;
+
+  // the usual form first: four decimal bytes, no leading zeros
+  if (parse_dotted_quad(p, end, quad)) {
+    in.s_addr = htonl(quad);
+    return true;
+  }
+
+  for (;;) {
+    uint64_t value = 0;
+    unsigned base  = 10;
+    int      digits = 0;
 
-  if (inet_ntop(AF_INET6, &address.in6, buff, sizeof(buff))) {
-    host = string(buff);
+    if (p < end and *p == '0') {
+      base = 8;
+      p++;
+      digits = 1;                              // a lone "0" is a number
+      if (p < end and (*p == 'x' or *p == 'X')) {
+        base   = 16;
+        digits = 0;
+        p++;
+      }
+    }
+    for (; p < end; p++) {
+      unsigned d = digit_value(*p);
+      if (d > 9 and base == 16)
+        d = hex_value(*p);                       // -1 is too large too
+      if (d >= base)
+        break;
+      value = value * base + d;
+      if (value > 0xffffffffULL)
+        return false;
+      digits++;
+    }
+    if (digits == 0 or nparts == 4)
+      return false;
+    parts[nparts++] = value;
+
+    if (p == end)
+      break;
+    if (*p++ != '.' or p == end)
+      return false;
   }
-  else {
-    logger->critical("Invalid address for family AF_INET6");
-    throw("Configured address has no textual representation. Aborting");
+
+  // all parts but the last are bytes. The last one takes what is left
+  uint32_t addr = 0;
+  for (int i=0; i<nparts-1; i++) {
+    if (parts[i] > 0xff)
+      return false;
+    addr |= parts[i] << (24 - 8 * i);
   }
+  uint32_t last = parts[nparts - 1];
+  if (nparts > 1 and last >> (8 * (5 - nparts)))
+    return false;
+  addr |= last;
+
+  in.s_addr = htonl(addr);
+  return true;
 }
 
-// destructor
-IPv6Address::~IPv6Address() {}
+// groups of 1 to 4 hex digits, at most one "::" standing for one or more
+// zero groups and an optional dotted quad in the last 32 bits
+static bool parse_ipv6(const char* p, const char* end, struct in6_addr& in6) {
+  unsigned char bytes[16];
+  int           n          = 0;            // bytes filled
+  int           gap        = -1;           // where "::" was
+  unsigned      value      = 0;
+  int           digits     = 0;
+  const char*   group      = p;
+
+  if (p < end and *p == ':' and (++p == end or *p != ':'))
+    return false;
+
+  while (p < end) {
+    char c = *p++;
+    int  d = hex_value(c);
+
+    if (d >= 0) {
+      if (++digits > 4)
+        return false;
+      value = (value << 4) | d;
+      continue;
+    }
+    if (c == ':') {
+      group = p;
+      if (digits == 0) {
+        if (gap >= 0)
+          return false;
+        gap = n;
+        continue;
+      }
+      if (p == end or n + 2 > 16)
+        return false;
+      bytes[n++] = value >> 8;
+      bytes[n++] = value & 0xff;
+      value  = 0;
+      digits = 0;
+      continue;
+    }
+    if (c == '.' and n + 4 <= 16) {
+      uint32_t quad;
+      if (not parse_dotted_quad(group, end, quad))
+        return false;
+      for (int i=0; i<4; i++)
+        bytes[n + i] = quad >> (24 - 8 * i);
+      n     += 4;
+      digits = 0;
+      break;
+    }
+    return false;
+  }
+
+  if (digits > 0) {
+    if (n + 2 > 16)
+      return false;
+    bytes[n++] = value >> 8;
+    bytes[n++] = value & 0xff;
+  }
 
-void* IPv6Address::get_binaddr() const {
-  return (void *) &address.in6;
+  if (gap >= 0) {
+    if (n == 16)                               // "::" stands for nothing
+      return false;
+    int tail = n - gap;
+    memmove(bytes + 16 - tail, bytes + gap, tail);
+    memset(bytes + gap, 0, 16 - tail - gap);
+    n = 16;
+  }
+  if (n != 16)
+    return false;
+
+  memcpy(in6.s6_addr, bytes, sizeof(bytes));
+  return true;
 }
 
-bool IPv6Address::operator==(const Address& other) const {
+// interface index, or interface name
+static bool parse_zone(const char* p, const char* end, uint32_t& scope_id) {
+  char name[IFNAMSIZ];
 
-  cout << "comparing gets at IPv6 Address" << endl;
+  if (p == end)
+    return false;
 
-  if (other.get_family() != AF_INET6)
+  uint64_t value = 0;
+  const char* q = p;
+  for (; q < end and *q >= '0' and *q <= '9'; q++) {
+    value = value * 10 + (*q - '0');
+    if (value > 0xffffffffULL)
+      return false;
+  }
+  if (q == end) {
+    scope_id = value;
+    return true;
+  }
+
+  if ((size_t) (end - p) >= sizeof(name))
+    return false;
+  memcpy(name, p, end - p);
+  name[end - p] = '\0';
+  scope_id = if_nametoindex(name);
+
+  return scope_id != 0;
+}
+
+bool AddressValue::parse(const char* text, size_t len, int family,
+                         AddressValue& addr) {
+  const char* end = text + len;
+
+  if (len == 0)
     return false;
 
-  auto in6addr = (struct in6_addr*) other.get_binaddr();
+  // The result is stored field by field: a temporary built with narrow
+  // stores and copied with wide loads would stall store forwarding
+  //
+  // IPv4 first: its literals have no ':', so no scan is needed for them
+  if (family == AF_INET or family == AF_UNSPEC) {
+    struct in_addr in;
+
+    if (parse_ipv4(text, end, in)) {
+      memset(&addr.addr, 0, sizeof(addr.addr));
+      addr.addr.in  = in;
+      addr.scope_id = 0;
+      addr.family   = AF_INET;
+      return true;
+    }
+  }
+
+  if (family == AF_INET6 or
+      ((family == AF_UNSPEC or family == AF_INET) and
+       memchr(text, ':', len))) {
+    uint32_t    sid  = 0;
+    const char* zone = (const char*) memchr(text, '%', len);
+
+    if (zone and not parse_zone(zone + 1, end, sid))
+      return false;
+    if (not parse_ipv6(text, zone ? zone : end, addr.addr.in6))
+      return false;
+    addr.scope_id = sid;
+    addr.family   = AF_INET6;
+    if (family != AF_INET)
+      return true;
+
+    // as getaddrinfo(), v4 mapped addresses are taken for IPv4 ones
+    if (not addr.is_v4mapped())
+      return false;
+    memmove(addr.addr.bytes, addr.addr.bytes + 12, 4);
+    memset(addr.addr.bytes + 4, 0, 12);
+    addr.scope_id = 0;
+    addr.family   = AF_INET;
+    return true;
+  }
+
+  return false;
+}
 
-  for (int i=0; i<16; i++) {
-     if (in6addr->s6_addr[i] != address.in6.s6_addr[i])
-       return false;
+bool parse_port(const char* text, size_t len, unsigned short& port) {
+  unsigned value = 0;
+
+  if (len == 0 or len > 5)
+    return false;
+
+  for (size_t i=0; i<len; i++) {
+    if (text[i] < '0' or text[i] > '9')
+      return false;
+    value = value * 10 + (text[i] - '0');
   }
+  if (value > 65535)
+    return false;
 
+  port = value;
   return true;
 }
 
-bool IPv6Address::is_multicast() {
+// copy 'len' bytes of text, cut to fit 'size'
+static size_t copy_text(char* buf, size_t size, const char* text, size_t len) {
+
+  if (size == 0)
+    return 0;
+  len = min(len, size - 1);
+  memcpy(buf, text, len);
+  buf[len] = '\0';
 
-  // check if IN6_IS_ADDR_V4MAPPED(&address) and v4 address is multicast
-  if (IN6_IS_ADDR_V4MAPPED(&address.in6)) {
-    in_addr_t v4addr = ntohl(*(const in_addr_t *) &address.in6.s6_addr[12]);
-    return IN_MULTICAST(v4addr);
+  return len;
+}
+
+// dotted quad straight from the binary form
+static size_t format_ipv4(char* text, const struct in_addr& in) {
+  auto  bytes = (const unsigned char*) &in.s_addr;
+  char* p = text;
+
+  for (int i=0; i<4; i++) {
+    unsigned int b = bytes[i];
+    if (b >= 100) {
+      *p++ = '0' + b / 100;
+      b %= 100;
+      *p++ = '0' + b / 10;
+    }
+    else if (b >= 10)
+      *p++ = '0' + b / 10;
+    *p++ = '0' + b % 10;
+    if (i < 3)
+      *p++ = '.';
   }
 
-  return IN6_IS_ADDR_MULTICAST(&address.in6);
+  return p - text;
 }
 
-string IPv6Address::print() {
+// Interface names by index, so that printing scoped addresses does not
+// ask the kernel each time. Slots are picked by index (they are small
+// and dense). A name is looked up again once stale, as interfaces come
+// and go. Indexes without an interface are kept too
+#define IFNAME_CACHE_SIZE  64
+#define IFNAME_CACHE_MSECS 30000
+
+typedef struct {
+  uint32_t  index;
+  long long expires;                   // steady clock msecs
+  char      name[IFNAMSIZ];            // empty if there is no interface
+} ifname_entry_t;
+
+static mutex          ifname_mutex;
+static ifname_entry_t ifname_cache[IFNAME_CACHE_SIZE];
+
+// name of interface 'index' into 'name' (IFNAMSIZ bytes). Returns its
+// length, 0 if there is no such interface
+static size_t interface_name(uint32_t index, char* name) {
+  long long now = mono_msecs();
+  lock_guard<mutex> lock(ifname_mutex);
+  ifname_entry_t&   entry = ifname_cache[index % IFNAME_CACHE_SIZE];
+
+  if (entry.index != index or now >= entry.expires) {
+    if (not if_indextoname(index, entry.name))
+      entry.name[0] = '\0';
+    entry.index   = index;
+    entry.expires = now + IFNAME_CACHE_MSECS;
+  }
+  size_t len = strlen(entry.name);
+  memcpy(name, entry.name, len + 1);
+
+  return len;
+}
 
-  if (scope_id > 0) {
-    unsigned int scope = get_scope();
+// 16 bit group in hex, no leading zeros
+static char* format_group(char* p, unsigned int group) {
+  static const char digits[] = "0123456789abcdef";
+  int n = (35 - __builtin_clz(group | 1)) / 4;
 
-    if (not IN6_IS_ADDR_UNSPECIFIED(&address.in6) and
-        not IN6_IS_ADDR_LOOPBACK(&address.in6)    and
-        not (scope == SCP_GLOBAL)) {
+  for (int shift = 4 * (n - 1); shift >= 0; shift -= 4)
+    *p++ = digits[(group >> shift) & 0xf];
 
-      char ifname[IFNAMSIZ];
+  return p;
+}
+
+// RFC 5952 text: lower case, no leading zeros, the first longest run of
+// two or more zero groups as "::". As inet_ntop() does, IPv4-mapped and
+// IPv4-compatible addresses end in a dotted quad ("::ffff:10.1.2.3")
+static size_t format_ipv6_text(char* text, const struct in6_addr& in6) {
+  const unsigned char* bytes = in6.s6_addr;
+  unsigned int         groups[8];
+  unsigned int         zeros = 0;            // bit i: group i is zero
+
+  for (int i=0; i<8; i++) {
+    groups[i] = bytes[2 * i] << 8 | bytes[2 * i + 1];
+    zeros    |= (groups[i] == 0) << i;
+  }
 
-      if (if_indextoname(scope_id, ifname))
-        return host + "%" + string(ifname);
+  // after n rounds bit i is set if groups i to i + n are zero. The last
+  // non empty mask has the starts of the longest runs
+  unsigned int runs   = zeros;
+  unsigned int starts = 0;
+  int          len    = 0;
+  while (runs) {
+    starts = runs;
+    runs  &= runs >> 1;
+    len++;
+  }
+  int gap = len >= 2 ? __builtin_ctz(starts) : -1; // -1: no "::"
+
+  char* p = text;
+  for (int i=0; i<8; i++) {
+    if (i >= gap and i < gap + len) {
+      if (i == gap)
+        *p++ = ':';
+      continue;
     }
+    if (i > 0)
+      *p++ = ':';
+    if (i == 6 and gap == 0 and
+        (len == 6 or (len == 5 and groups[5] == 0xffff))) {
+      struct in_addr in;
+      memcpy(&in, bytes + 12, sizeof(in));
+      p += format_ipv4(p, in);
+      break;
+    }
+    p = format_group(p, groups[i]);
   }
+  if (gap + len == 8)
+    *p++ = ':';
 
-  return host;
+  return p - text;
 }
 
-unsigned int IPv6Address::get_scope() {
+// the zone is only shown for scoped addresses
+static size_t format_ipv6(char* text, const struct in6_addr& in6,
+                          uint32_t scope_id, unsigned int scope) {
+  size_t len = format_ipv6_text(text, in6);
+
+  if (scope_id > 0                       and
+      not IN6_IS_ADDR_UNSPECIFIED(&in6)  and
+      not IN6_IS_ADDR_LOOPBACK(&in6)     and
+      not (scope == SCP_GLOBAL)) {
+    size_t n = interface_name(scope_id, text + len + 1);
+    if (n > 0) {
+      text[len] = '%';
+      len += 1 + n;
+    }
+  }
 
-  if (IN6_IS_ADDR_UNSPECIFIED(&address.in6))
-    return SCP_INVSCOPE;
+  return len;
+}
 
-  if (IN6_IS_ADDR_LOOPBACK(&address.in6) or IN6_IS_ADDR_LINKLOCAL(&address.in6))
-    return SCP_LINKLOCAL;
+static size_t format_mac(char* text, const struct mac_addr& mac) {
+  static const char digits[] = "0123456789abcdef";
+  char* p = text;
 
-  if IN6_IS_ADDR_MULTICAST(&address.in6)
-    return (unsigned int) address.in6.s6_addr[1] & 0x0f;
+  for (int i=0; i<6; i++) {
+    unsigned char b = mac.sl2_addr[i];
+    *p++ = digits[b >> 4];
+    *p++ = digits[b & 0xf];
+    if (i < 5)
+      *p++ = ':';
+  }
 
-  return SCP_GLOBAL;
+  return p - text;
 }
 
-//// Link layer address
+size_t AddressValue::format(char* buf, size_t size) const {
+  char   text[INET6_ADDRSTRLEN + 1 + IFNAMSIZ];
+  size_t len = 0;
+
+  switch (family) {
+    case AF_INET:     len = format_ipv4(text, addr.in);
+                      break;
+    case AF_INET6:    len = format_ipv6(text, addr.in6, scope_id, get_scope());
+                      break;
+    case AF_LOCAL_L2: len = format_mac(text, addr.mac);
+                      break;
+  }
+
+  return copy_text(buf, size, text, len);
+}
+
+string AddressValue::print() const {
+  char text[ADDRESS_TEXT_SIZE];
+
+  return string(text, format(text, sizeof(text)));
+}
+
+//// Address base class. Constructor and methods
 //
-LinkLayerAddress::LinkLayerAddress(mac_addr addr): Address(addr) {
-  char buff[32];
-  
-  if (snprintf(buff, sizeof(buff), "%02x:%02x:%02x:%02x:%02x:%02x",
-                 address.mac.sl2_addr[0], address.mac.sl2_addr[1],
-                 address.mac.sl2_addr[2], address.mac.sl2_addr[3],
-                 address.mac.sl2_addr[4], address.mac.sl2_addr[5])  < 0) {
-    logger->critical("Invalid address for Link Layer address family");
-    throw("Configured address has no textual representation. Aborting");
+Address::Address(const AddressValue& addr) : value(addr), text(nullptr) {}
+
+// copies render their own text
+Address::Address(const Address& other) : value(other.value), text(nullptr) {}
+
+Address& Address::operator=(const Address& other) {
+
+  if (this != &other) {
+    value = other.value;
+    delete text.exchange(nullptr);
   }
 
-  host = string(buff);
+  return *this;
 }
 
+// Destructor
+Address::~Address() {
+  delete text.load();
+}
+
+// Text of the address, rendered on first use. Threads racing to render it
+// keep the first copy published
+const string& Address::rendered() const {
+  string* current = text.load(memory_order_acquire);
+
+  if (current)
+    return *current;
+
+  char buf[ADDRESS_TEXT_SIZE];
+  string* mine = new string(buf, value.format(buf, sizeof(buf)));
+  if (text.compare_exchange_strong(current, mine, memory_order_acq_rel))
+    return *mine;
+
+  delete mine;
+  return *current;
+}
+
+sa_family_t Address::get_family() const {
+  return value.get_family();
+}
+
+const AddressValue& Address::get_value() const {
+  return value;
+}
+
+// These are virtual functions to be overriden in derived classes
+//
+bool Address::operator==(const Address& other) const {
+  cout << "comparing gets at Address base" << endl;
+  return false;
+}
+
+bool Address::is_multicast() {
+  return value.is_multicast();
+}
+
+// the text up to the IPv6 zone, if any
+string Address::print() {
+  const string& host = rendered();
+
+  if (value.get_family() == AF_INET6)
+    return host.substr(0, host.find('%'));
+
+  return host;
+}
+
+// from the rendered text once there is one
+size_t Address::format(char* buf, size_t size) const {
+  const string* current = text.load(memory_order_acquire);
+
+  if (current)
+    return copy_text(buf, size, current->data(), current->size());
+
+  return value.format(buf, size);
+}
+
+void* Address::get_binaddr() const {
+  return (void *) value.get_binaddr();
+}
+
+////////   IPv4Address is a derived class from Address
+//
+IPv4Address::IPv4Address(struct in_addr addr) : Address(AddressValue(addr)) {}
+
 // destructor
-LinkLayerAddress::~LinkLayerAddress() {}
+IPv4Address::~IPv4Address() {}
+
+bool IPv4Address::operator==(const Address& other) const {
+
+  cout << "comparing gets at IPv4 Address" << endl;
 
-void* LinkLayerAddress::get_binaddr() const {
-  return (void *) &address.mac;
+  return value == other.get_value();
 }
 
-bool LinkLayerAddress::operator==(const Address& other) const {
+////////   IPv6Address is a derived class from Address
+//
+IPv6Address::IPv6Address(struct in6_addr addr, int sid) :
+                Address(AddressValue(addr, sid)) {}
 
-  if (other.get_family() != AF_LOCAL_L2)
-    return false;
+// destructor
+IPv6Address::~IPv6Address() {}
 
-  auto macaddr = (struct mac_addr*) other.get_binaddr();
+bool IPv6Address::operator==(const Address& other) const {
 
-  for (int i=0; i<6; i++) {
-     if (macaddr->sl2_addr[i] != address.mac.sl2_addr[i])
-       return false;
-  }
+  cout << "comparing gets at IPv6 Address" << endl;
 
-  return true;
+  return value == other.get_value();
+}
+
+bool IPv6Address::is_v4mapped() {
+  return value.is_v4mapped();
+}
+
+string IPv6Address::print() {
+  return rendered();
+}
+
+unsigned int IPv6Address::get_scope() const {
+  return value.get_scope();
+}
+
+//// Link layer address
+//
+LinkLayerAddress::LinkLayerAddress(mac_addr addr) :
+                    Address(AddressValue(addr)) {}
+
+// destructor
+LinkLayerAddress::~LinkLayerAddress() {}
+
+bool LinkLayerAddress::operator==(const Address& other) const {
+  return value == other.get_value();
 }
 
 // Factory functions to create addresses based on textual representation
 //
+// Addresses carry no port: the service is only checked. Numeric ports are
+// parsed, names looked up in the services database for the protocol of
+// 'type', so getaddrinfo() is never needed
+static bool check_service(const string& service, int type) {
+  unsigned short  port;
+  struct servent  entry;
+  struct servent* found;
+  char            buffer[1024];
+
+  if (service.empty() or parse_port(service.data(), service.size(), port))
+    return true;
+
+  const char* proto = type == SOCK_STREAM ? "tcp" :
+                      type == SOCK_DGRAM  ? "udp" : nullptr;
+  if (getservbyname_r(service.c_str(), proto, &entry, buffer, sizeof(buffer),
+                      &found) != 0 or found == nullptr) {
+    LOG_ERROR(logger, "unknown service: %s", service);
+    return false;
+  }
+
+  return true;
+}
+
 Address* get_ip_address(const string& host, const string& service,
                         int family, int type) {
-  int  res;
-
-  struct addrinfo   aih;
-  struct addrinfo*  pai;
-  struct sockaddr_in*  psin;
-  struct sockaddr_in6* psin6;
-  Address* addr;
-  
-  aih.ai_flags     = AI_NUMERICHOST;
-  aih.ai_family    = family;
-  aih.ai_socktype  = SOCK_DGRAM;
-  aih.ai_protocol  = 0;
-  aih.ai_addrlen   = 0;
-  aih.ai_addr      = nullptr;
-  aih.ai_canonname = nullptr;
-  aih.ai_next      = nullptr;
-  
-  res = getaddrinfo(host.c_str(),
-                    service.empty() ? nullptr : service.c_str(), &aih, &pai);
-  if (res != 0) {
-    logger->error("getaddrinfo error: %s", gai_strerror(res));
-    return nullptr;
-  }
+  AddressValue value;
 
-  // while getaddrinfo may return multiple addresses matching requirements,
-  // we expect just a single address here
-  // May change in the future if 'domain' addresses are used 
-  // Note that host addresses are re-checked
-  //   - IPv4 addresses may be written in 'network format' ("192.1")
-  //   - IPv6 addresses may contain 'zone_id' ("fe80::1%eth0")
+  if (not check_service(service, type))
+    return nullptr;
 
-  if (pai->ai_addr->sa_family == AF_INET) {
-    psin = (struct sockaddr_in*) pai->ai_addr;
-    addr = new IPv4Address(psin->sin_addr);
-  }
-  else if (pai->ai_addr->sa_family == AF_INET6) {
-    psin6 = (struct sockaddr_in6*) pai->ai_addr;
-    addr = new IPv6Address(psin6->sin6_addr, psin6->sin6_scope_id);
-  }
-  else {
-    logger->error("getaddrinfo: invalid address family");
-    addr = nullptr;
+  if (not AddressValue::parse(host.data(), host.size(), family, value)) {
+    LOG_ERROR(logger, "invalid numeric address: %s", host);
+    return nullptr;
   }
 
-  freeaddrinfo(pai);
+  if (value.get_family() == AF_INET)
+    return new IPv4Address(*(const struct in_addr*) value.get_binaddr());
 
-  return addr;
+  return new IPv6Address(*(const struct in6_addr*) value.get_binaddr(),
+                         value.get_scope_id());
 }
 
 Address* get_mac_address(const string& host) {
@@ -339,7 +849,7 @@ Address* get_mac_address(const string& host) {
 
   if (pos < 6 or *p) {
     // wrong syntax
-    logger->error("wrong link layer address syntax: %s", host.c_str());
+    LOG_ERROR(logger, "wrong link layer address syntax: %s", host.c_str());
     return nullptr;
   }
 
@@ -353,7 +863,7 @@ Address* get_address(const string& host, const string& service,
   Address* addr = nullptr;
 
   if (host.size() > MAX_HOST_STRLEN) {
-    logger->error("Maximum address length exceeded");
+    LOG_ERROR(logger, "Maximum address length exceeded");
     return addr;
   }
 
@@ -367,10 +877,10 @@ Address* get_address(const string& host, const string& service,
       tmphost = string("::");
     else {
       if (family == AF_LOCAL_L2)
-        logger->error("Invalid NULL MAC address");
+        LOG_ERROR(logger, "Invalid NULL MAC address");
       else   // AF_UNSPEC
-        logger->error("Ambiguous NULL address. "
-                      "Specify '0.0.0.0', or '::' for IPv6");
+        LOG_ERROR(logger, "Ambiguous NULL address. "
+                          "Specify '0.0.0.0', or '::' for IPv6");
       return addr;
     }
   }
@@ -384,7 +894,7 @@ Address* get_address(const string& host, const string& service,
     case AF_INET6:
     case AF_UNSPEC:    addr = get_ip_address(chost, service, family, type);
                        break;
-    default:           logger->error("Invalid address family: %d", family);
+    default:           LOG_ERROR(logger, "Invalid address family: %d", family);
                        break;
   }
 
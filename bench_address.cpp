@@ -0,0 +1,270 @@
+/*
+A multicast interface to the socket library
+
+  bench_address: numeric address parsing benchmark
+
+    Parses a set of address literals with getaddrinfo(AI_NUMERICHOST), the
+    former path of get_address(), and with AddressValue::parse(), and
+    reports nsecs per call and the speedup. Both must agree on every
+    literal. get_address() is timed too, heap object included
+
+    The bulk conversions (addrbatch.h) are timed with every kernel the
+    CPU has, per address, against inet_pton() and inet_ntop() loops
+
+    Results are written as JSON, as bench_logging does
+
+    usage: bench_address [iterations [json file]]
+
+*/
+
+#include <netdb.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "addrbatch.h"
+#include "address.h"
+
+using namespace std;
+
+#define BENCH_ITERATIONS  200000
+#define BENCH_BATCH       10000      // addresses per bulk call
+
+typedef chrono::steady_clock bench_clock;
+
+static const char* literals[] = {
+  "192.168.1.20",
+  "10.1",
+  "0x7f.1",
+  "239.255.0.1",
+  "::1",
+  "ff02::1234:5678%1",
+  "2001:db8:85a3::8a2e:370:7334",
+  "2001:db8:85a3:1:2:8a2e:370:7334",
+  "::ffff:130.206.1.2",
+};
+
+typedef struct {
+  string literal;
+  double getaddrinfo_ns;
+  double parse_ns;
+  double get_address_ns;
+} bench_result_t;
+
+typedef struct {
+  string kernel;
+  double parse_ns;                 // per address
+  double format_ns;
+} batch_result_t;
+
+static const char* kernel_names[] = { "scalar", "sse4", "avx2" };
+
+static double nsecs_per_call(bench_clock::time_point start, int iterations) {
+  return chrono::duration_cast<chrono::nanoseconds>(
+           bench_clock::now() - start).count() / (double) iterations;
+}
+
+// the former path
+static bool parse_getaddrinfo(const char* literal, AddressValue& addr) {
+  struct addrinfo  hints;
+  struct addrinfo* res;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_flags    = AI_NUMERICHOST;
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  if (getaddrinfo(literal, nullptr, &hints, &res) != 0)
+    return false;
+  addr = AddressValue::from_sockaddr(res->ai_addr);
+  freeaddrinfo(res);
+
+  return true;
+}
+
+static bench_result_t run_literal(const char* literal, int iterations) {
+  bench_result_t result;
+  AddressValue   expected, addr;
+  size_t         len = strlen(literal);
+  unsigned long  ok  = 0;
+
+  result.literal = literal;
+
+  if (not parse_getaddrinfo(literal, expected) or
+      not AddressValue::parse(literal, len, AF_UNSPEC, addr) or
+      addr != expected or addr.get_scope_id() != expected.get_scope_id()) {
+    cerr << "bench_address: parsers disagree on " << literal << endl;
+    exit(1);
+  }
+
+  auto start = bench_clock::now();
+  for (int i=0; i<iterations; i++)
+    ok += parse_getaddrinfo(literal, addr);
+  result.getaddrinfo_ns = nsecs_per_call(start, iterations);
+
+  start = bench_clock::now();
+  for (int i=0; i<iterations; i++)
+    ok += AddressValue::parse(literal, len, AF_UNSPEC, addr);
+  result.parse_ns = nsecs_per_call(start, iterations);
+
+  string host(literal);
+  start = bench_clock::now();
+  for (int i=0; i<iterations; i++) {
+    Address* a = get_address(host);
+    ok += a != nullptr;
+    delete a;
+  }
+  result.get_address_ns = nsecs_per_call(start, iterations);
+
+  if (ok != 3UL * iterations) {
+    cerr << "bench_address: " << literal << " failed to parse" << endl;
+    exit(1);
+  }
+
+  return result;
+}
+
+// bulk calls over BENCH_BATCH random addresses. The "libc" kernel loops
+// over inet_pton() and inet_ntop()
+static vector<batch_result_t> run_batch(int iterations) {
+  vector<batch_result_t> results;
+  vector<struct in_addr> addrs(BENCH_BATCH);
+  vector<string>         strings;
+  vector<const char*>    texts;
+  unique_ptr<bool[]>     valid(new bool[BENCH_BATCH]);
+  unique_ptr<char[][INET_ADDRSTRLEN]> out(
+    new char[BENCH_BATCH][INET_ADDRSTRLEN]);
+  mt19937 rng(1);
+
+  for (auto& in : addrs) {
+    char text[INET_ADDRSTRLEN];
+    in.s_addr = rng();
+    strings.push_back(inet_ntop(AF_INET, &in, text, sizeof(text)));
+  }
+  for (auto& s : strings)
+    texts.push_back(s.c_str());
+
+  int    rounds = max(1, iterations / 100);
+  double calls  = (double) rounds * BENCH_BATCH;
+  batch_result_t libc = { "libc", 0, 0 };
+
+  auto start = bench_clock::now();
+  for (int r=0; r<rounds; r++)
+    for (int i=0; i<BENCH_BATCH; i++)
+      inet_pton(AF_INET, texts[i], &addrs[i]);
+  libc.parse_ns = nsecs_per_call(start, 1) / calls;
+
+  start = bench_clock::now();
+  for (int r=0; r<rounds; r++)
+    for (int i=0; i<BENCH_BATCH; i++)
+      inet_ntop(AF_INET, &addrs[i], out[i], INET_ADDRSTRLEN);
+  libc.format_ns = nsecs_per_call(start, 1) / calls;
+  results.push_back(libc);
+
+  int selected = get_batch_kernel();
+  for (int k=BATCH_SCALAR; k<=BATCH_AVX2; k++) {
+    if (not set_batch_kernel(k))
+      continue;
+    batch_result_t result = { kernel_names[k], 0, 0 };
+
+    start = bench_clock::now();
+    for (int r=0; r<rounds; r++)
+      if (parse_ipv4_batch(texts.data(), BENCH_BATCH, addrs.data(),
+                           valid.get()) != BENCH_BATCH) {
+        cerr << "bench_address: " << kernel_names[k] << " parse failed" << endl;
+        exit(1);
+      }
+    result.parse_ns = nsecs_per_call(start, 1) / calls;
+
+    start = bench_clock::now();
+    for (int r=0; r<rounds; r++)
+      format_ipv4_batch(addrs.data(), BENCH_BATCH, out.get());
+    result.format_ns = nsecs_per_call(start, 1) / calls;
+    results.push_back(result);
+  }
+  set_batch_kernel(selected);
+
+  return results;
+}
+
+static void write_json(ostream& os, const vector<bench_result_t>& results,
+                       const vector<batch_result_t>& batch, int iterations) {
+  char   date[32];
+  time_t now = time(nullptr);
+  struct tm tm;
+
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &tm));
+
+  os << "{\n"
+     << "  \"benchmark\": \"bench_address\",\n"
+     << "  \"date\": \"" << date << "\",\n"
+#ifdef NDEBUG
+     << "  \"build\": \"release\",\n"
+#else
+     << "  \"build\": \"debug\",\n"
+#endif
+     << "  \"iterations\": " << iterations << ",\n"
+     << "  \"results\": [\n";
+
+  for (size_t i=0; i<results.size(); i++) {
+    const bench_result_t& r = results[i];
+
+    os << "    { \"literal\": \"" << r.literal << "\""
+       << ", \"getaddrinfo_ns\": " << (long long) r.getaddrinfo_ns
+       << ", \"parse_ns\": " << (long long) r.parse_ns
+       << ", \"speedup\": " << (long long) (r.getaddrinfo_ns / r.parse_ns)
+       << ", \"get_address_ns\": " << (long long) r.get_address_ns
+       << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+
+  os << "  ],\n"
+     << "  \"batch\": [\n";
+
+  for (size_t i=0; i<batch.size(); i++) {
+    const batch_result_t& b = batch[i];
+
+    os << "    { \"kernel\": \"" << b.kernel << "\""
+       << ", \"parse_ns\": " << b.parse_ns
+       << ", \"format_ns\": " << b.format_ns
+       << " }" << (i + 1 < batch.size() ? "," : "") << "\n";
+  }
+
+  os << "  ]\n"
+     << "}" << endl;
+}
+
+int main(int argc, char* argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : BENCH_ITERATIONS;
+  vector<bench_result_t> results;
+
+  if (argc > 3 or iterations <= 0) {
+    cerr << "usage: " << argv[0] << " [iterations [json file]]" << endl;
+    return 1;
+  }
+
+  for (auto literal : literals)
+    results.push_back(run_literal(literal, iterations));
+  vector<batch_result_t> batch = run_batch(iterations);
+
+  if (argc > 2) {
+    ofstream ofs(argv[2]);
+    if (not ofs.is_open()) {
+      cerr << argv[0] << ": cannot open " << argv[2] << endl;
+      return 1;
+    }
+    write_json(ofs, results, batch, iterations);
+  }
+  else
+    write_json(cout, results, batch, iterations);
+
+  return 0;
+}
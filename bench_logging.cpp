@@ -0,0 +1,331 @@
+/*
+A multicast interface to the socket library
+
+  bench_logging: logger throughput and latency benchmark suite
+
+    Every case logs a number of records from 1 to N threads and reports
+    the records/sec and the latency of single log calls (p50, p99, p99.9
+    and maximum, in nsecs). Cases cover:
+      - filtered records (level disabled) and emitted records
+      - a standard stream sink and file sinks (batched, unbatched, with
+        rotation, asynchronous mode, JSON records)
+      - a shallow module (BENCH) and a deep one logging through the sink
+        of its ancestor (T1.T2.T3.T4 with the file on T1)
+      - the former per record path (ofstream, '<< endl' plus flush())
+
+    The cost of a call at a disabled level, too short to be timed on its
+    own, is timed over a long run of them, through LOG_INFO and info()
+
+    Results are written as JSON, to track regressions across releases.
+    The standard error is redirected to a scratch file while the stream
+    cases run
+
+    usage: bench_logging [records [max threads [json file]]]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logging.h"
+
+using namespace std;
+
+#define BENCH_FILE     "bench_logging.log"
+#define BENCH_STREAM   "bench_logging.err"   // standard error of stream cases
+#define BENCH_RECORDS  100000                // per case
+#define BENCH_THREADS  8                     // default maximum
+#define BENCH_ROTATE   (1024 * 1024)         // rotation size (bytes)
+#define BENCH_KEEP     2
+#define BENCH_DISABLED 10000000              // calls timed together
+
+#define SHALLOW_MODULE "BENCH"
+#define DEEP_TOP       "T1"
+#define DEEP_MODULE    "T1.T2.T3.T4"
+
+typedef chrono::steady_clock bench_clock;
+
+// sink kinds
+#define BS_OFSTREAM    0
+#define BS_STREAM      1
+#define BS_FILE        2
+#define BS_UNBATCHED   3
+#define BS_ROTATING    4
+#define BS_ASYNC       5
+#define BS_JSON        6
+
+static const char* sink_names[] = { "ofstream", "stream", "file",
+                                    "file-unbatched", "file-rotating",
+                                    "file-async", "file-json" };
+
+typedef struct {
+  int  sink;                  // BS_XXX
+  int  threads;
+  bool deep;                  // log through T1.T2.T3.T4
+  bool emitted;               // false: records below the logger level
+} bench_case_t;
+
+typedef struct {
+  bench_case_t      bcase;
+  int               records;
+  double            rate;     // records/sec
+  vector<long long> nsecs;    // per call latencies, sorted
+} bench_result_t;
+
+static long long elapsed_nsecs(bench_clock::time_point start) {
+  return chrono::duration_cast<chrono::nanoseconds>(
+           bench_clock::now() - start).count();
+}
+
+static void remove_files() {
+
+  unlink(BENCH_FILE);
+  for (int i=1; i<=BENCH_KEEP; i++)
+    unlink((string(BENCH_FILE) + '.' + to_string(i)).c_str());
+}
+
+// the logging path before sinks existed
+static void run_ofstream(bench_result_t& result) {
+  char record[128];
+  ofstream logfile(BENCH_FILE, ios::app);
+
+  auto start = bench_clock::now();
+  for (int i=0; i<result.records; i++) {
+    auto call = bench_clock::now();
+    int len = snprintf(record, sizeof(record),
+                       "2023/01/01:00:00:00 BENCH: [info] record number %d", i);
+    logfile.write(record, len);
+    logfile << endl;
+    logfile.flush();
+    result.nsecs[i] = elapsed_nsecs(call);
+  }
+  result.rate = result.records * 1e9 / elapsed_nsecs(start);
+}
+
+// Sets up the sink of a case on the logger owning it: the logger itself
+// or, for deep cases, its top ancestor
+static void setup_sink(logptr_t owner, int sink) {
+
+  switch (sink) {
+    case BS_STREAM:
+      owner->set_streamer(STDERR);
+      break;
+    case BS_UNBATCHED:
+      owner->set_batching(0, SINK_BATCH_MSECS);
+      owner->set_logfile(BENCH_FILE);
+      break;
+    case BS_ROTATING:
+      owner->set_rotation(BENCH_ROTATE, 0, BENCH_KEEP);
+      owner->set_logfile(BENCH_FILE);
+      break;
+    case BS_ASYNC:
+      Logger::start_async();
+      owner->set_logfile(BENCH_FILE);
+      break;
+    case BS_JSON:
+      owner->set_format(SINK_JSON);
+      owner->set_logfile(BENCH_FILE);
+      break;
+    default:
+      owner->set_logfile(BENCH_FILE);
+      break;
+  }
+}
+
+static void teardown_sink(logptr_t owner, int sink) {
+
+  owner->flush();
+  if (sink == BS_ASYNC)
+    Logger::stop_async();
+  owner->set_streamer(DEVNULL);
+  owner->set_logfile("");
+  owner->set_rotation(0, 0);
+  owner->set_batching(SINK_BATCH_BYTES, SINK_BATCH_MSECS);
+  owner->set_format(SINK_TEXT);
+}
+
+static void run_logger(bench_result_t& result) {
+  const bench_case_t& bc = result.bcase;
+  int level = bc.emitted ? INFO : WARNING;
+  logptr_t logger = Logger::get_logger(bc.deep ? DEEP_MODULE : SHALLOW_MODULE,
+                                       level, DEVNULL);
+  logptr_t owner  = bc.deep ? Logger::get_logger(DEEP_TOP, level, DEVNULL) :
+                              logger;
+  int per_thread  = result.records / bc.threads;
+  int saved_err   = -1;
+  vector<thread> workers;
+
+  if (bc.sink == BS_STREAM) {
+    fflush(stderr);
+    saved_err = dup(STDERR_FILENO);
+    int fd = open(BENCH_STREAM, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, STDERR_FILENO);
+    close(fd);
+  }
+  setup_sink(owner, bc.sink);
+
+  auto start = bench_clock::now();
+  for (int t=0; t<bc.threads; t++)
+    workers.push_back(thread([&result, logger, per_thread, t]() {
+      long long* nsecs = result.nsecs.data() + t * per_thread;
+      for (int i=0; i<per_thread; i++) {
+        auto call = bench_clock::now();
+        LOG_INFO(logger, "record number %d from %s", i, "bench");
+        nsecs[i] = elapsed_nsecs(call);
+      }
+    }));
+  for (auto& w : workers)
+    w.join();
+  owner->flush();
+  result.rate = per_thread * bc.threads * 1e9 / elapsed_nsecs(start);
+  result.nsecs.resize(per_thread * bc.threads);
+
+  teardown_sink(owner, bc.sink);
+  if (saved_err >= 0) {
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_err);
+    unlink(BENCH_STREAM);
+  }
+}
+
+// nsecs per call below the logger level, through the macro and directly
+static void run_disabled(double& macro, double& direct) {
+  logptr_t logger = Logger::get_logger(SHALLOW_MODULE, WARNING, DEVNULL);
+
+  auto start = bench_clock::now();
+  for (int i=0; i<BENCH_DISABLED; i++)
+    LOG_INFO(logger, "record number %d from %s", i, "bench");
+  macro = elapsed_nsecs(start) / (double) BENCH_DISABLED;
+
+  start = bench_clock::now();
+  for (int i=0; i<BENCH_DISABLED; i++)
+    logger->info("record number %d from %s", i, "bench");
+  direct = elapsed_nsecs(start) / (double) BENCH_DISABLED;
+}
+
+static bench_result_t run_case(const bench_case_t& bc, int records) {
+  bench_result_t result;
+
+  result.bcase   = bc;
+  result.records = records;
+  result.nsecs.resize(records);
+
+  remove_files();
+  if (bc.sink == BS_OFSTREAM)
+    run_ofstream(result);
+  else
+    run_logger(result);
+  remove_files();
+
+  sort(result.nsecs.begin(), result.nsecs.end());
+
+  return result;
+}
+
+static long long percentile(const vector<long long>& sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  size_t i = (size_t) (sorted.size() * p);
+  return sorted[min(i, sorted.size() - 1)];
+}
+
+static void write_json(ostream& os, const vector<bench_result_t>& results,
+                       int records, double macro, double direct) {
+  char   date[32];
+  time_t now = time(nullptr);
+  struct tm tm;
+
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &tm));
+
+  os << "{\n"
+     << "  \"benchmark\": \"bench_logging\",\n"
+     << "  \"date\": \"" << date << "\",\n"
+#ifdef NDEBUG
+     << "  \"build\": \"release\",\n"
+#else
+     << "  \"build\": \"debug\",\n"
+#endif
+     << "  \"hardware_threads\": " << thread::hardware_concurrency() << ",\n"
+     << "  \"records_per_case\": " << records << ",\n"
+     << "  \"disabled_level_ns\": { \"macro\": " << macro
+     << ", \"direct\": " << direct << " },\n"
+     << "  \"results\": [\n";
+
+  for (size_t i=0; i<results.size(); i++) {
+    const bench_result_t& r  = results[i];
+    const bench_case_t&   bc = r.bcase;
+
+    os << "    { \"sink\": \"" << sink_names[bc.sink] << "\""
+       << ", \"threads\": " << bc.threads
+       << ", \"hierarchy\": \"" << (bc.deep ? "deep" : "shallow") << "\""
+       << ", \"emitted\": " << (bc.emitted ? "true" : "false")
+       << ", \"records_per_sec\": " << (long long) r.rate
+       << ", \"latency_ns\": { \"p50\": " << percentile(r.nsecs, 0.50)
+       << ", \"p99\": " << percentile(r.nsecs, 0.99)
+       << ", \"p99.9\": " << percentile(r.nsecs, 0.999)
+       << ", \"max\": " << (r.nsecs.empty() ? 0 : r.nsecs.back())
+       << " } }" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+
+  os << "  ]\n"
+     << "}" << endl;
+}
+
+int main(int argc, char* argv[]) {
+  int records     = argc > 1 ? atoi(argv[1]) : BENCH_RECORDS;
+  int max_threads = argc > 2 ? atoi(argv[2]) : BENCH_THREADS;
+  vector<bench_case_t>   cases;
+  vector<bench_result_t> results;
+
+  if (records <= 0 or max_threads <= 0 or argc > 4) {
+    cerr << "usage: " << argv[0] << " [records [max threads [json file]]]"
+         << endl;
+    return 1;
+  }
+
+  // 1, 2, 4 ... and the maximum
+  vector<int> thread_counts;
+  for (int threads=1; threads<max_threads; threads*=2)
+    thread_counts.push_back(threads);
+  thread_counts.push_back(max_threads);
+
+  cases.push_back({ BS_OFSTREAM, 1, false, true });
+  for (int threads : thread_counts) {
+    for (bool deep : { false, true }) {
+      cases.push_back({ BS_FILE, threads, deep, false });
+      for (int sink : { BS_STREAM, BS_FILE, BS_UNBATCHED, BS_ASYNC })
+        cases.push_back({ sink, threads, deep, true });
+    }
+  }
+  cases.push_back({ BS_ROTATING, 1, false, true });
+  cases.push_back({ BS_JSON, 1, false, true });
+
+  double macro, direct;
+  run_disabled(macro, direct);
+  for (auto& bc : cases)
+    results.push_back(run_case(bc, records));
+
+  if (argc > 3) {
+    ofstream ofs(argv[3]);
+    if (not ofs.is_open()) {
+      cerr << argv[0] << ": cannot open " << argv[3] << endl;
+      return 1;
+    }
+    write_json(ofs, results, records, macro, direct);
+  }
+  else
+    write_json(cout, results, records, macro, direct);
+
+  return 0;
+}
@@ -46,11 +46,9 @@ NetworkInterface* find_interface_address(string address) {
 
   for (auto ni : get_network_interfaces())
     for (auto ad : ni->addrvec) {
-      string p1 = ad->print();
-      string p2 = addr->print();
-      logger->warning("---> comparing %s to %s", p1.c_str(), p2.c_str());
+      LOG_WARNING(logger, "---> comparing %s to %s", ad, addr);
       if (*ad == *addr) {
-        logger->warning("match for %s in %s", p1.c_str(), ni->name.c_str());
+        LOG_WARNING(logger, "match for %s in %s", ad, ni->name);
         delete addr;
         return ni;
       }
@@ -90,7 +88,7 @@ vector<NetworkInterface*>  get_network_interfaces(string ifname,
   struct ifaddrs* ifp;
 
   if (getifaddrs(&ifap) != 0) {
-    logger->error("getifaddr error: %s", strerror(errno));
+    LOG_ERROR(logger, "getifaddr error: %s", strerror(errno));
     throw("getifaddrs");
   }
 
@@ -100,18 +98,18 @@ vector<NetworkInterface*>  get_network_interfaces(string ifname,
     // select name
     string name        = ifp->ifa_name;
     unsigned int flags = ifp->ifa_flags;
-    logger->debug("name: %s, flags: 0x%x", ifp->ifa_name, flags);
+    LOG_DEBUG(logger, "name: %s, flags: 0x%x", ifp->ifa_name, flags);
     if (ifname.size() > 0 and name != ifname)
       continue;
 
     // If interface does not have a L2 address, the 'addr' field is NULL
     if (not ifp->ifa_addr) {
-      logger->debug("  *** empty addr field");
+      LOG_DEBUG(logger, "  *** empty addr field");
       continue;
     }
 
     sa_family_t family = ifp->ifa_addr->sa_family;
-    logger->debug("  family: %d", family);
+    LOG_DEBUG(logger, "  family: %d", family);
 
     // check if interface name is already in list
     ni = find_interface(name, namevec);
@@ -141,16 +139,16 @@ vector<NetworkInterface*>  get_network_interfaces(string ifname,
       pastart = psl2->sll_addr;
       index = psl2->sll_ifindex;
 #endif
-      logger->debug("  index: %d", index);
+      LOG_DEBUG(logger, "  index: %d", index);
     }
 
     if (not ni) {
       if (index == 0) {
-        logger->debug("  *** could not find index. L2 address expected");
+        LOG_DEBUG(logger, "  *** could not find index. L2 address expected");
         continue;
       }
       ni = new NetworkInterface(name, index, flags);
-      logger->debug("  created network interface %s", ifp->ifa_name);
+      LOG_DEBUG(logger, "  created network interface %s", ifp->ifa_name);
       namevec.push_back(ni);
     }
 
@@ -186,13 +184,13 @@ vector<NetworkInterface*>  get_network_interfaces(string ifname,
     }
 
     if (addr) {
-      string paddr = addr->print();
+      // address text is only rendered when debug records are written
       if (ni) {
         ni->addrvec.push_back(addr);
-        logger->debug("  created address: %s", paddr.c_str());
+        LOG_DEBUG(logger, "  created address: %s", addr);
       }
       else {
-        logger->debug("  error creating container for addr: %s", paddr.c_str());
+        LOG_DEBUG(logger, "  error creating container for addr: %s", addr);
         delete addr;
       }
     }
@@ -0,0 +1,38 @@
+#ifndef INC_ADDRBATCH
+#define INC_ADDRBATCH
+
+#include <stddef.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Bulk IPv4 text conversion
+//
+// Subscription lists, allow-lists and status dumps hold thousands of
+// dotted quads. These convert whole arrays of them, with SSE4.1 or AVX2
+// kernels (one and two addresses per instruction) where the CPU has them
+// and a scalar loop otherwise. The kernel is picked at run time, on the
+// first call. Results are those of inet_pton(AF_INET) and inet_ntop(AF_INET)
+// whichever kernel runs
+//
+#define BATCH_SCALAR  0
+#define BATCH_SSE4    1
+#define BATCH_AVX2    2
+
+// Dotted quads of the NUL terminated 'texts' into 'addrs'. As inet_pton(),
+// only the strict form is taken: 4 decimal parts, no leading zeros. Entries
+// that are not one get 'valid'[i] false and a zero address. Returns the
+// number of valid entries
+size_t parse_ipv4_batch(const char* const* texts, size_t count,
+                        struct in_addr* addrs, bool* valid);
+
+// Dotted quads of 'addrs', NUL terminated, into 'texts'
+void format_ipv4_batch(const struct in_addr* addrs, size_t count,
+                       char (*texts)[INET_ADDRSTRLEN]);
+
+// kernel in use (BATCH_XXX)
+int  get_batch_kernel();
+
+// use 'kernel' from now on. Returns false if the CPU lacks it
+bool set_batch_kernel(int kernel);
+
+#endif
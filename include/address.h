@@ -1,9 +1,14 @@
 #ifndef INC_ADDRESS
 #define INC_ADDRESS
 
+#include <stdint.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
 
+#include <atomic>
+#include <string>
+
 #define MAX_HOST_STRLEN   32
 #define MAC_SEPARATORS ":.|;"
 
@@ -25,66 +30,102 @@ struct mac_addr {
   unsigned char sl2_addr[6];
 };
 
-union Addrunion {
-  struct in_addr  in;
-  struct in6_addr in6;
-  struct mac_addr mac;
-  Addrunion(struct in_addr  addr);
-  Addrunion(struct in6_addr addr);
-  Addrunion(struct mac_addr addr);
-};
+// text of any address fits, IPv6 zone included
+#define ADDRESS_TEXT_SIZE 64
 
-typedef union Addrunion addrunion_t;
+// A network address as a plain value
+//
+// Family, binary address and IPv6 scope id in 24 bytes, with no heap
+// memory and no virtual functions: values are trivially copyable, so
+// tables of addresses can be kept in contiguous arrays. Link layer
+// addresses take the first 6 bytes. Unused bytes are zero
+//
+class AddressValue {
+  private:
+    union {
+      struct in_addr  in;
+      struct in6_addr in6;
+      struct mac_addr mac;
+      unsigned char   bytes[16];
+    } addr;
+    uint32_t      scope_id;       // IPv6 interface index, 0 if none
+    sa_family_t   family;         // AF_UNSPEC for no address
+  public:
+    AddressValue();
+    explicit AddressValue(struct in_addr addr);
+    explicit AddressValue(struct in6_addr addr, uint32_t sid=0);
+    explicit AddressValue(struct mac_addr addr);
+    // IPv4 and IPv6 socket addresses. AF_UNSPEC for other families
+    static AddressValue from_sockaddr(const struct sockaddr* sa);
+    // Numeric IPv4 or IPv6 address of 'family' (AF_UNSPEC for either) in
+    // the 'len' bytes of 'text'. IPv4 takes the inet_aton() forms ("10.1",
+    // "0x7f.1", ...), IPv6 those of RFC 4291 with an optional zone, a
+    // number or an interface name ("fe80::1%eth0"). Nothing is allocated
+    // Returns false if 'text' is not such an address
+    static bool parse(const char* text, size_t len, int family,
+                      AddressValue& addr);
+    sa_family_t   get_family() const   { return family; }
+    uint32_t      get_scope_id() const { return scope_id; }
+    // binary form (in_addr, in6_addr or mac_addr). nullptr for no address
+    const void*   get_binaddr() const;
+    // IPv6 address scope (SCP_XXX). SCP_INVSCOPE for other families
+    unsigned int  get_scope() const;
+    bool          is_multicast() const;
+    bool          is_v4mapped() const;
+    // same family and address. Scope ids are not compared
+    bool operator==(const AddressValue& other) const;
+    bool operator!=(const AddressValue& other) const;
+    // by family, then address bytes in network order
+    bool operator<(const AddressValue& other) const;
+    // textual form into 'buf' (NUL terminated, cut to fit), without
+    // allocating. IPv6 addresses with a scope id get their zone
+    // ("fe80::1%eth0"). Returns its length
+    size_t        format(char* buf, size_t size) const;
+    std::string   print() const;
+};
 
 // A base class from which all types of addresses are derived 
+// Addresses are thin wrappers of an AddressValue. Their text is rendered
+// by the first print() and kept: building an address formats nothing
 class Address {
   // This object represents an address satisfying a given condition
   protected:
-    addrunion_t   address;        // Binary form of address
-    sa_family_t   family;         // Address family
-    std::string   host;           // Textual representation of address
+    AddressValue  value;          // Family and binary form of address
+    mutable std::atomic<std::string*> text;  // Rendered text, once printed
     //
-    Address(struct in_addr   addr);
-    Address(struct in6_addr  addr);
-    Address(struct mac_addr  addr);
+    Address(const AddressValue& addr);
+    const std::string& rendered() const;
   public:
     sa_family_t   get_family() const;
+    const AddressValue& get_value() const;
+    Address(const Address& other);
+    Address& operator=(const Address& other);
     virtual ~Address();
     virtual bool operator==(const Address& other) const;
+    // the address alone (no IPv6 zone)
     virtual std::string print();
+    // textual form into 'buf' (NUL terminated, cut to fit), without
+    // allocating. Returns its length. ADDRESS_TEXT_SIZE bytes are enough
+    virtual size_t      format(char* buf, size_t size) const;
     virtual bool        is_multicast();
     virtual void* get_binaddr() const;
 };
 
 class IPv4Address : public Address {
-  protected:
-    //int         service;
-    std::string ipv4mapped;
-    // The address can be constructed either from the binary representation
-    // or from the textual one, whenever provided
   public:
     IPv4Address(struct in_addr addr);
     ~IPv4Address();
-    void* get_binaddr() const;
     bool operator==(const Address& other) const;
-    bool  is_multicast();
 };
 
 class IPv6Address : public Address {
-  protected:
-    //int         service;
-    std::string map4;
-    int         scope;
-    int         scope_id;
-    std::string zone_id;
   public:
     IPv6Address(struct in6_addr addr, int sid=0);
     ~IPv6Address();
-    void* get_binaddr() const;
     bool operator==(const Address& other) const;
-    unsigned int get_scope();
+    unsigned int get_scope() const;
+    // with the zone of addresses that have a scope id ("fe80::1%eth0")
     std::string print();
-    bool is_multicast();
     bool is_v4mapped();
 };
 
@@ -92,7 +133,6 @@ class LinkLayerAddress : public Address {
   public:
     LinkLayerAddress(struct mac_addr macb);
     ~LinkLayerAddress();
-    void* get_binaddr() const;
     bool operator==(const Address& other) const;
 };
 
@@ -102,6 +142,9 @@ class InterfaceIPv4Address : public IPv4Address {
     InterfaceIPv4Address(struct in_addr addr, const std::string iface);
 };
 //
+// Numeric port ("0" to "65535"). Returns false for anything else
+bool parse_port(const char* text, size_t len, unsigned short& port);
+//
 // External factory
 //
 Address* get_address(const std::string& host,
@@ -0,0 +1,237 @@
+#ifndef INC_LOGBINARY
+#define INC_LOGBINARY
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <type_traits>
+
+#include "address.h"
+#include "logformat.h"
+
+// Binary log file layout
+//
+// A header followed by a sequence of entries. Every entry starts with a
+// binlog_entry_t and its size is a multiple of 8. Entries are written
+// concurrently into a memory mapped file: the size is stored when space is
+// reserved and the type when the entry is complete, so a reader skips
+// incomplete entries and stops at the first zero size
+// Values are stored in native byte order
+//
+#define BINLOG_MAGIC    "MCLOGBIN"
+#define BINLOG_VERSION  2
+#define BINLOG_SIZE     (64 << 20)     // default file size
+#define BINLOG_COPIED_FORMATS  4096    // formats of direct calls
+
+// entry types
+#define BL_INCOMPLETE   0
+#define BL_FORMAT       1              // id -> format string
+#define BL_MODULE       2              // id -> module name
+#define BL_RECORD       3              // log record
+#define BL_THREAD       4              // thread tag -> thread name
+
+typedef struct {
+  char     magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t file_size;
+} binlog_header_t;
+
+typedef struct {
+  uint32_t size;          // entry size, this header included
+  uint16_t type;          // BL_XXX. Stored last
+  uint8_t  level;         // record level
+  uint8_t  precision;     // timestamp precision when the record was taken
+  uint32_t id;            // format id (BL_RECORD, BL_FORMAT), module id,
+                          // thread tag (BL_THREAD)
+  uint32_t module;        // module id (BL_RECORD)
+  uint32_t thread;        // thread tag (BL_RECORD). See Logger::get_thread_tag
+  uint32_t nsec;          // timestamp (BL_RECORD)
+  int64_t  sec;
+} binlog_entry_t;
+// entry payload: format/module/thread text (NUL terminated) or record
+// arguments
+
+// Argument encoding
+//
+// Every argument starts with a tag byte: its kind (LA_XXX) and, for
+// integers, the size of their type and whether it is signed. Integers,
+// enums and pointers then take 8 bytes, floating point values are stored
+// as a double and strings as a 4 byte length followed by the bytes.
+// Addresses are stored as strings. The decoder rebuilds the typed values
+// from the tags and formats them as the text path does (log_format())
+//
+#define BINLOG_NULL_STRING "(null)"
+#define BINLOG_TAG(kind, size, sgn)  ((kind) | (size) << 3 | ((sgn) ? 0x80 : 0))
+#define BINLOG_TAG_KIND(tag)         ((tag) & 0x07)
+#define BINLOG_TAG_SIZE(tag)         ((tag) >> 3 & 0x0f)
+#define BINLOG_TAG_SIGNED(tag)       (((tag) & 0x80) != 0)
+#define BINLOG_RENDER_ARGS  64          // arguments rendered per record
+
+template <typename T, int K = log_kind<T>::value>
+struct binlog_arg {
+  static_assert(K != LA_OTHER,
+                "log arguments must be numbers, pointers, strings or addresses");
+};
+
+// integers are sign or zero extended, as log_value() does
+template <typename T>
+struct binlog_arg<T, LA_INT> {
+  static size_t size(T) {
+    return 1 + 8;
+  }
+  static char* put(char* p, T v) {
+    uint64_t slot = (uint64_t) (int64_t) v;
+    *p = BINLOG_TAG(LA_INT, sizeof(T), std::is_signed<T>::value);
+    memcpy(p + 1, &slot, 8);
+    return p + 1 + 8;
+  }
+};
+
+template <typename T>
+struct binlog_arg<T, LA_FLOAT> {
+  static size_t size(T) {
+    return 1 + 8;
+  }
+  static char* put(char* p, T v) {
+    double slot = v;
+    *p = BINLOG_TAG(LA_FLOAT, 0, false);
+    memcpy(p + 1, &slot, 8);
+    return p + 1 + 8;
+  }
+};
+
+template <typename T>
+struct binlog_arg<T, LA_POINTER> {
+  static size_t size(T) {
+    return 1 + 8;
+  }
+  static char* put(char* p, T v) {
+    uint64_t slot = (uint64_t) (uintptr_t) v;
+    *p = BINLOG_TAG(LA_POINTER, 0, false);
+    memcpy(p + 1, &slot, 8);
+    return p + 1 + 8;
+  }
+};
+
+template <typename T>
+struct binlog_arg<T, LA_STRING> {
+  template <typename S>
+  static size_t size(const S& s) {
+    return 1 + 4 + log_text_len(s);
+  }
+  template <typename S>
+  static char* put(char* p, const S& s) {
+    uint32_t len = log_text_len(s);
+    *p = BINLOG_TAG(LA_STRING, 0, false);
+    memcpy(p + 1, &len, 4);
+    memcpy(p + 1 + 4, log_text(s), len);
+    return p + 1 + 4 + len;
+  }
+};
+
+// room for the longest text. Only the actual text is kept
+static_assert(LOG_ADDRESS_SIZE >= ADDRESS_TEXT_SIZE,
+              "address text must fit the text records too");
+template <typename T>
+struct binlog_arg<T, LA_ADDRESS> {
+  static size_t size(const T&) {
+    return 1 + 4 + ADDRESS_TEXT_SIZE;
+  }
+  static char* put(char* p, const T& v) {
+    auto     a   = log_address(v);
+    uint32_t len = a ? a->format(p + 1 + 4, ADDRESS_TEXT_SIZE) :
+                       strlen(strcpy(p + 1 + 4, BINLOG_NULL_STRING));
+    *p = BINLOG_TAG(LA_STRING, 0, false);
+    memcpy(p + 1, &len, 4);
+    return p + 1 + 4 + len;
+  }
+};
+
+inline size_t binlog_args_size() {
+  return 0;
+}
+
+template <typename T, typename... Args>
+size_t binlog_args_size(const T& v, const Args&... args) {
+  return binlog_arg<typename std::decay<T>::type>::size(v) +
+         binlog_args_size(args...);
+}
+
+inline char* binlog_put_args(char* p) {
+  return p;
+}
+
+template <typename T, typename... Args>
+char* binlog_put_args(char* p, const T& v, const Args&... args) {
+  return binlog_put_args(binlog_arg<typename std::decay<T>::type>::put(p, v),
+                         args...);
+}
+
+// Same encoding for typed values (direct calls, whose argument types are
+// only known at run time)
+size_t binlog_values_size(const log_value_t* values, size_t count);
+char*  binlog_put_values(char* p, const log_value_t* values, size_t count);
+
+// A memory mapped binary log file
+//
+class BinaryLog {
+  private:
+    int                 fd;
+    char*               base;          // mapping
+    size_t              size;
+    std::atomic<size_t> tail;          // next free offset
+    std::atomic<int>    writers;       // threads writing into the mapping
+    std::atomic<bool>   closed;
+    std::atomic<unsigned long> dropped;
+  public:
+    BinaryLog();
+    ~BinaryLog();
+    BinaryLog(BinaryLog const&)      = delete;
+    void operator=(BinaryLog const&) = delete;
+    bool open(const std::string& fname, size_t fsize);
+    void close();
+    // entry reservation. Returns nullptr if the log is full or closed
+    // Every successful acquire() must be followed by release()
+    bool acquire();
+    void release();
+    binlog_entry_t* reserve(size_t len);
+    void commit(binlog_entry_t* entry, uint16_t type);
+    // write a definition entry
+    void define(uint16_t type, uint32_t id, const char* text);
+    unsigned long get_dropped() const;
+    size_t get_used() const;
+};
+
+// The process wide binary log and its format/module/thread registries
+// Formats and modules get a number the first time they are logged. The
+// definitions are written to the active log then, and to every new log
+// when it is opened. Threads are defined when they are named
+BinaryLog* binlog_active();
+bool       binlog_open(const std::string& fname, size_t fsize);
+void       binlog_close();
+uint32_t   binlog_format_id(std::atomic<uint32_t>& fid, const char* format);
+// Format number for the typed values of a direct call. The format need
+// not be a literal: it is copied and looked up by content, through a per
+// thread cache. Returns 0 if the values do not fit the format, or once
+// BINLOG_COPIED_FORMATS formats were copied
+uint32_t   binlog_values_format_id(const char* format,
+                                   const log_value_t* values, size_t count);
+uint32_t   binlog_module_id(std::atomic<uint32_t>& mid, const std::string& name);
+void       binlog_thread_name(uint32_t thread, const std::string& name);
+// Write a file header and the known definitions to 'fd', for logs not
+// written through BinaryLog. Without 'wait' the registries are read even
+// if locked (crash time)
+bool       binlog_write_preamble(int fd, bool wait);
+
+// Render the message of a binary record using its format string, as
+// log_format() renders the same call. Returns the message length (which
+// may exceed 'size', as snprintf)
+size_t binlog_render(char* buf, size_t size, const char* format,
+                     const char* args, size_t arglen);
+
+#endif
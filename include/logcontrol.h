@@ -0,0 +1,45 @@
+#ifndef INC_LOGCONTROL
+#define INC_LOGCONTROL
+
+#include <string>
+
+// Runtime control of the loggers
+//
+// A background thread serves a Unix domain socket, so that levels and
+// outputs can be changed in a running process ('logctl' is a client, or
+// 'socat - UNIX-CONNECT:<path>'). Clients send one command per line and
+// get back the command output followed by a line with "ok" or
+// "error: <reason>". Changes go through the regular Logger setters: new
+// settings are published to emitting threads, which never block on them
+// Clients are served one at a time, and dropped after CONTROL_IDLE_MSECS
+// without a command
+//
+//   list                          loggers: module level efflevel
+//                                 propagate stream file
+//   stats                         counters: module records bytes
+//                                 filtered suppressed dropped
+//   stats filtered on|off         count calls filtered out by the level
+//                                 (off by default)
+//   level <module> <level>        debug, info, warning, error, critical,
+//                                 unset or a number
+//   propagate <module> on|off
+//   stream <module> stdout|stderr|stdlog|none
+//   file <module> [<path>]        no path closes the log file
+//   flush [<module>]              all loggers if no module is given
+//   help
+//
+// Only existing loggers can be changed. "root" names the root logger
+//
+#define CONTROL_LINE_SIZE   1024   // longest command
+#define CONTROL_CLIENTS     4      // pending connections
+#define CONTROL_IDLE_MSECS  10000  // clients idle this long are dropped
+
+// Start serving 'path' (the socket is created, replacing a stale one, and
+// only accessible by the owner). Fails if already started, or if 'path'
+// exists and is not a socket
+bool control_start(const std::string& path);
+void control_stop();
+// Run a single command. Returns its reply, status line included
+std::string control_execute(const std::string& command);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef INC_LOGFLIGHT
+#define INC_LOGFLIGHT
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+#include "logbinary.h"
+
+// Flight recorder
+//
+// A fixed size in memory ring keeping the last records logged at any
+// level, whether or not they are written anywhere. Records are stored as
+// binary log entries (see logbinary.h): nothing is formatted unless the
+// record was formatted anyway. The ring is written out as a binary log
+// file, to be rendered by 'logdecode', on demand or on a fatal signal
+//
+// Writers take a sequence number and own its slot while they fill it.
+// A slot is stamped as busy first and complete last, so that a dump skips
+// slots being written. The ring being much larger than the number of
+// concurrent writers, a slot is not reused while still being filled
+//
+#define FLIGHT_RECORDS    4096     // default ring size (records)
+#define FLIGHT_SLOT_SIZE  256      // room for a record, entry header included
+
+typedef struct {
+  std::atomic<uint64_t> stamp;     // 2*seq+1 being written, 2*seq+2 complete
+  char data[FLIGHT_SLOT_SIZE];     // binlog_entry_t and arguments
+} flight_slot_t;
+
+class FlightRecorder {
+  private:
+    flight_slot_t*             slots;
+    size_t                     count;
+    std::atomic<uint64_t>      head;       // next sequence number
+    std::atomic<unsigned long> dropped;    // records larger than a slot
+  public:
+    explicit FlightRecorder(size_t records);
+    FlightRecorder(FlightRecorder const&) = delete;
+    void operator=(FlightRecorder const&) = delete;
+    // Room for an entry of 'len' bytes. Returns nullptr if it does not
+    // fit in a slot. Every entry returned must be committed
+    binlog_entry_t* reserve(size_t len, uint64_t& seq);
+    void commit(uint64_t seq);
+    // Write the ring to 'fd' as a binary log. Async signal safe
+    bool dump(int fd);
+    unsigned long get_dropped() const;
+};
+
+// The process wide flight recorder (nullptr if not started). Never
+// deleted: threads may still be writing into it after it is stopped
+extern std::atomic<FlightRecorder*> active_flight;
+
+inline FlightRecorder* flight_active() {
+  return active_flight.load(std::memory_order_acquire);
+}
+// start recording. If 'crash_file' is given the ring is written to it
+// on SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT. The ring is allocated
+// by the first call. Later calls reuse it
+bool flight_start(size_t records, const std::string& crash_file);
+void flight_stop();
+// write the ring to a file (also after stopping)
+bool flight_dump(const char* fname);
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef INC_LOGFORMAT
+#define INC_LOGFORMAT
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <cstddef>
+#include <string>
+#include <type_traits>
+
+// Type safe formatting of log messages
+//
+// Log calls take printf style formats, but arguments keep their types:
+// they are passed as an array of typed values to a formatter which has
+// fast paths for plain integer and string conversions. Addresses
+// (pointers or references to Address objects) are formatted with '%s'
+// straight from their binary form. The LOG_XXX macros also check at
+// compile time that every conversion matches its argument
+//
+class Address;
+
+#define LOG_ADDRESS_SIZE  64       // as ADDRESS_TEXT_SIZE (address.h)
+
+// argument kinds
+#define LA_OTHER    0              // cannot be logged
+#define LA_INT      1              // integers, characters, booleans, enums
+#define LA_FLOAT    2
+#define LA_STRING   3              // C strings, std::string
+#define LA_POINTER  4
+#define LA_ADDRESS  5              // Address objects or pointers to them
+
+template <typename T>
+struct log_is_string : std::integral_constant<bool,
+                         std::is_same<T, char*>::value or
+                         std::is_same<T, const char*>::value or
+                         std::is_same<T, std::string>::value> {};
+
+// the pointee is only looked at when it is a class
+template <typename T,
+          typename C = typename std::remove_cv<
+                         typename std::remove_pointer<T>::type>::type>
+struct log_is_address : std::conditional<std::is_class<C>::value,
+                          std::is_base_of<Address, C>,
+                          std::false_type>::type {};
+
+template <typename T>
+struct log_kind : std::integral_constant<int,
+                    std::is_integral<T>::value or
+                    std::is_enum<T>::value          ? LA_INT     :
+                    std::is_floating_point<T>::value ? LA_FLOAT   :
+                    log_is_string<T>::value          ? LA_STRING  :
+                    log_is_address<T>::value         ? LA_ADDRESS :
+                    std::is_pointer<T>::value or
+                    std::is_same<T, std::nullptr_t>::value ? LA_POINTER :
+                    LA_OTHER> {};
+
+// A typed argument
+typedef struct {
+  int    kind;                     // LA_XXX
+  bool   is_signed;                // LA_INT
+  int    width;                    // LA_INT: size of the argument type
+  union {
+    uint64_t    i;
+    double      d;
+    const void* p;                 // LA_POINTER, LA_ADDRESS
+    const char* s;                 // LA_STRING
+  } v;
+  size_t len;                      // LA_STRING
+  size_t (*format)(const void* address, char* buf, size_t size);
+} log_value_t;
+
+template <typename A>
+size_t log_format_address(const void* address, char* buf, size_t size) {
+  return static_cast<const A*>(address)->format(buf, size);
+}
+
+inline const char* log_text(const char* s) {
+  return s ? s : "(null)";
+}
+inline const char* log_text(const std::string& s) {
+  return s.c_str();
+}
+inline size_t log_text_len(const char* s) {
+  return strlen(log_text(s));
+}
+inline size_t log_text_len(const std::string& s) {
+  return s.size();
+}
+
+template <typename A>
+const A* log_address(const A& a) {
+  return &a;
+}
+template <typename A>
+const A* log_address(A* a) {
+  return a;
+}
+
+template <typename T, int K = log_kind<T>::value>
+struct log_arg {
+  static_assert(K != LA_OTHER,
+                "log arguments must be numbers, pointers, strings or addresses");
+};
+
+template <typename T>
+struct log_arg<T, LA_INT> {
+  static void make(log_value_t& lv, T v) {
+    lv.kind      = LA_INT;
+    lv.is_signed = std::is_signed<T>::value;
+    lv.width     = sizeof(T);
+    lv.v.i       = (uint64_t) (int64_t) v;
+  }
+};
+
+template <typename T>
+struct log_arg<T, LA_FLOAT> {
+  static void make(log_value_t& lv, T v) {
+    lv.kind = LA_FLOAT;
+    lv.v.d  = v;
+  }
+};
+
+template <typename T>
+struct log_arg<T, LA_STRING> {
+  template <typename S>
+  static void make(log_value_t& lv, const S& v) {
+    lv.kind = LA_STRING;
+    lv.v.s  = log_text(v);
+    lv.len  = log_text_len(v);
+  }
+};
+
+template <typename T>
+struct log_arg<T, LA_POINTER> {
+  static void make(log_value_t& lv, T v) {
+    lv.kind = LA_POINTER;
+    lv.v.p  = (const void*) v;
+  }
+};
+
+template <typename T>
+struct log_arg<T, LA_ADDRESS> {
+  typedef typename std::remove_cv<
+            typename std::remove_pointer<T>::type>::type address_t;
+  static void make(log_value_t& lv, const T& v) {
+    lv.kind   = LA_ADDRESS;
+    lv.v.p    = log_address(v);
+    lv.format = log_format_address<address_t>;
+  }
+};
+
+template <typename T>
+log_value_t log_value(const T& v) {
+  log_value_t lv;
+  log_arg<typename std::decay<T>::type>::make(lv, v);
+  return lv;
+}
+
+// Format 'format' with 'values' into 'buf'. Always NUL terminated
+// Returns the message length, which may exceed 'size' (as snprintf)
+size_t log_format(char* buf, size_t size, const char* format,
+                  const log_value_t* values, size_t count);
+
+// Whether 'values' fit the conversions of 'format', in kind and number
+// (what LOG_CHECK_FORMAT checks at compile time)
+bool log_format_fits(const char* format, const log_value_t* values,
+                     size_t count);
+
+// JSON records
+//
+// One object per record, for sinks writing SINK_JSON records:
+//
+//   {"ts":1700000000.123,"module":"rx","thread":4242,"thread_name":"io",
+//    "level":"info","message":"...","args":[...],"key":"value"...}
+//
+// "ts" counts seconds since the epoch, with 'precision' decimals. The
+// thread name is only there for named threads, "args" (the arguments of
+// the log call, with their types) only for calls with arguments. Extra
+// fields come preformatted. Strings are escaped in place, with no
+// allocation; bytes above 0x7f are copied as they are (UTF-8 is expected)
+//
+typedef struct {
+  struct timespec    ts;
+  int                precision;    // digits of the fraction of seconds
+  const char*        module;       // empty for the root logger
+  size_t             modlen;
+  unsigned int       thread;
+  const char*        thread_name;  // empty if unnamed
+  const char*        level;
+  const char*        message;
+  size_t             msglen;
+  const log_value_t* values;
+  size_t             count;
+  const char*        fields;       // ',"key":value' pairs or empty
+  size_t             fieldslen;
+} log_json_t;
+
+// Escape 'len' bytes of 'text' for a JSON string (no quotes added)
+// Returns the escaped length, which may exceed 'size' (as snprintf)
+size_t log_json_escape(char* buf, size_t size, const char* text, size_t len);
+
+// Format 'record' into 'buf'. Always NUL terminated
+// Returns the record length, which may exceed 'size' (as snprintf)
+size_t log_json_record(char* buf, size_t size, const log_json_t& record);
+
+// Compile time format checking
+//
+// Walks the format one character at a time, consuming an argument type
+// for every conversion (and for '*' widths and precisions)
+//
+constexpr bool log_is_digit(char c) {
+  return c >= '0' and c <= '9';
+}
+constexpr bool log_is_flag(char c) {
+  return c == '-' or c == '+' or c == ' ' or c == '#' or c == '0' or
+         c == '\'';
+}
+constexpr bool log_is_lenmod(char c) {
+  return c == 'h' or c == 'l' or c == 'L' or c == 'q' or c == 'j' or
+         c == 'z' or c == 't';
+}
+constexpr bool log_conv_ok(char c, int kind) {
+  return c == 'd' or c == 'i' or c == 'u' or c == 'o' or c == 'x' or
+         c == 'X' or c == 'c'                ? kind == LA_INT :
+         c == 'e' or c == 'E' or c == 'f' or c == 'F' or c == 'g' or
+         c == 'G' or c == 'a' or c == 'A'    ? kind == LA_FLOAT :
+         c == 's'                            ? kind == LA_STRING or
+                                               kind == LA_ADDRESS :
+         c == 'p'                            ? kind == LA_POINTER :
+         false;
+}
+
+template <typename... Args>
+struct log_check;
+
+template <>
+struct log_check<> {
+  static constexpr bool run(const char* f) {
+    return *f == '\0' ? true :
+           *f != '%'  ? run(f + 1) :
+           f[1] == '%' ? run(f + 2) :
+           false;                                   // missing argument
+  }
+  // a conversion with no argument left
+  static constexpr bool dot(const char*)    { return false; }
+  static constexpr bool lenmod(const char*) { return false; }
+};
+
+template <typename T, typename... Rest>
+struct log_check<T, Rest...> {
+  static constexpr bool run(const char* f) {
+    return *f == '\0' ? false :                     // argument left over
+           *f != '%'  ? run(f + 1) :
+           f[1] == '%' ? run(f + 2) :
+           flags(f + 1);
+  }
+  static constexpr bool flags(const char* f) {
+    return log_is_flag(*f) ? flags(f + 1) : width(f);
+  }
+  static constexpr bool width(const char* f) {
+    return *f == '*'        ? log_kind<T>::value == LA_INT and
+                              log_check<Rest...>::dot(f + 1) :
+           log_is_digit(*f) ? width(f + 1) :
+           dot(f);
+  }
+  static constexpr bool dot(const char* f) {
+    return *f == '.' ? precision(f + 1) : lenmod(f);
+  }
+  static constexpr bool precision(const char* f) {
+    return *f == '*'        ? log_kind<T>::value == LA_INT and
+                              log_check<Rest...>::lenmod(f + 1) :
+           log_is_digit(*f) ? precision(f + 1) :
+           lenmod(f);
+  }
+  static constexpr bool lenmod(const char* f) {
+    return log_is_lenmod(*f) ? lenmod(f + 1) : conversion(f);
+  }
+  static constexpr bool conversion(const char* f) {
+    return log_conv_ok(*f, log_kind<T>::value) and
+           log_check<Rest...>::run(f + 1);
+  }
+};
+
+// only used in unevaluated context to get the argument types of a call
+template <typename... Args>
+log_check<typename std::decay<Args>::type...>
+log_check_args(const char* format, const Args&... args);
+
+#define LOG_FORMAT_OF(format, ...) format
+
+// LOG_CHECK_FORMAT(format, args...)
+#define LOG_CHECK_FORMAT(...)                                          \
+  static_assert(decltype(log_check_args(__VA_ARGS__))::run(            \
+                  LOG_FORMAT_OF(__VA_ARGS__, 0)),                      \
+                "log format does not match its arguments")
+
+#endif
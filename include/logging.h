@@ -1,13 +1,25 @@
 #ifndef INC_LOGGING
 #define INC_LOGGING
 
-#include <stdarg.h>
+#include <time.h>
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "logbinary.h"
+#include "logflight.h"
+#include "logformat.h"
+#include "loglimit.h"
+#include "logmcast.h"
+#include "logsink.h"
+#include "logstats.h"
+#include "snapshot.h"
 
 #define UNCHANGED  (-1)
 #define ROOT_DEBUG (-2)
@@ -29,6 +41,7 @@
 #define CRITICAL 5
 #define MINLOG   NOTSET
 #define MAXLOG   CRITICAL
+#define NOLOG    (MAXLOG+1)   // effective level of loggers with no output
 
 #define MODULE_NAME_SIZE       8
 #define MAX_MODULE_SUBFIELDS  24 
@@ -38,15 +51,66 @@
 
 #define TIMEFMT  "%Y/%m/%d:%H:%M:%S"
 
+#define LOG_HEADER_SIZE  128   // room for a record header
+#define LOG_RECORD_SIZE  256   // initial room for a message. Not a limit
+#define THREAD_NAME_SIZE 24    // thread names are truncated to fit
+#define THREAD_TAG_SIZE  (THREAD_NAME_SIZE + 16)  // "(name:tid) "
+
+// timestamp precision (number of decimal digits after the seconds)
+#define TS_SECONDS       0
+#define TS_MILLISECONDS  3
+#define TS_MICROSECONDS  6
+#define TS_NANOSECONDS   9
+
+// overflow policies for the asynchronous mode queue
+#define OVF_BLOCK       0      // wait for the writer to make room
+#define OVF_DROP_NEWEST 1      // discard the record being logged
+#define OVF_DROP_OLDEST 2      // discard the oldest queued record
+
+#define ASYNC_QUEUE_SIZE 4096
+
+// asynchronous mode counters
+typedef struct {
+  unsigned long queued;            // records accepted by the queue
+  unsigned long written;           // records written by the writer thread
+  unsigned long dropped_newest;    // records discarded on arrival
+  unsigned long dropped_oldest;    // records evicted from the queue
+} async_stats_t;
+
+// a logger as listed by get_logger_tree()
+typedef struct {
+  std::string module;              // full module name. "root" for the root
+  int         level;
+  int         efflevel;            // lowest level written along the chain
+  bool        propagate;
+  int         stream;              // DEVNULL, STDOUT, STDERR or STDLOG
+  std::string logfile;
+} logger_info_t;
+
+// the counters of a logger as listed by get_logger_stats()
+typedef struct {
+  std::string    module;           // full module name. "root" for the root
+  log_counters_t counters;
+} logger_stats_t;
+
 // The logger class
 // 
 class Logger;
 
-class Logger {
+class Logger : public std::enable_shared_from_this<Logger> {
+  friend class AsyncWriter;
+  friend class RepeatReporter;
   private:
     // local typedefs
     typedef std::shared_ptr<Logger> logptr_t;
     typedef std::weak_ptr<Logger>   logwptr_t;
+    typedef std::unordered_map<std::string, logwptr_t> logmap_t;
+    // a sink along the propagation chain and the level of its logger
+    typedef struct {
+      int       level;
+      sinkptr_t sink;
+    } route_t;
+    typedef std::vector<route_t> route_list_t;
     // this artifact prevents creation of instances from outside the class
     struct Private {
       explicit Private() = default;
@@ -54,24 +118,82 @@ class Logger {
     //
     std::string   modname;      // Module name
     int           loglevel;     // Current log level
-    std::ofstream logfile;      // File stream for the log file
+    std::shared_ptr<FdSink> logfile;    // Sink for the log file
     std::string   filename;     // Active log file
     std::ostream* outstream;    // Pointer to output stream
-    std::mutex    logmutex;     // Mutex for controlling output to stream/file
+    std::shared_ptr<FdSink> streamsink; // Sink for the output stream
+    std::shared_ptr<McastSink> mcastsink; // Sink for log shipping
+    size_t        batch_bytes;  // Log file batching (see FdSink)
+    unsigned int  batch_msecs;
+    int           flush_level;
+    unsigned long long rotate_bytes;  // Log file rotation (see FdSink)
+    unsigned int  rotate_secs;
+    unsigned int  rotate_keep;
+    int           record_format;  // Log file and shipping (SINK_XXX)
+    std::map<std::string, std::string> fields;  // Extra JSON fields
+    std::mutex    logmutex;     // Mutex for level, stream and file settings
     std::mutex    treemutex;    // Mutex for instance tree control
     bool          propagate;    // Continue the search upwards to the root
     logptr_t      parent;       // logger's ancestor
     std::map<std::string, logwptr_t> dict;      // Loggers Dictionary
+    bool          dying;        // Destructor running. No async logging
+    Snapshot<route_list_t> routes;  // Sinks along the propagation chain
+    std::atomic<int> efflevel;  // Lowest level written along the chain
+    std::atomic<int> gatelevel; // Lowest level looked at (see wanted())
+    std::atomic<bool> jsonchain;  // Some sink along the chain wants JSON
+    Snapshot<std::string> jsonfields;  // 'fields' as ',"key":"value"...'
+    std::atomic<uint32_t> binmodule;  // Module number in binary logs
+    std::atomic<unsigned int> repeat_msecs;  // Suppression window. 0: off
+    std::mutex    repeatmutex;  // Suppression state, updated as one
+    uint64_t      repeat_hash;  // Last message written
+    int           repeat_level;
+    long long     repeat_since; // mono_msecs() time
+    unsigned long repeats;      // Suppressed since
+    std::unique_ptr<LogSink> repeat_reporter;  // While suppression is on
+    LogCounters   counters;     // Activity (see logstats.h)
+    static std::atomic<bool> filtered_counting;  // see set_filtered_counting
     //
+    // instance tree
+    static logptr_t create_root(int level, bool& created);
+    static logptr_t find_logger(const std::string& module, int level);
+    static Snapshot<logmap_t>& registry();
     // extra debugging
     void set_root_debug();
+    // effective level maintenance
+    void update_levels();
+    void update_chain(const route_list_t& inherited);
+    route_list_t update_routes(const route_list_t& inherited);
+    static int  gate_for(int efflevel);
+    static void update_gates();
     // formatting of logging records
-    std::string& logrecord(std::string& record, const char* timefmt,
-                      std::string modname, std::string& message, int level);
-    std::string& logmessage(std::string& message,
-                      const char* format, va_list vl);
-    void logaux(int level, const char* format, va_list args);
-    static std::string level_to_string(int level);
+    size_t logrecord(size_t offset, const char* timefmt, int level,
+                     struct timespec& now);
+    size_t logjson(size_t offset, const struct timespec& now, int level,
+                   size_t msgoff, const log_value_t* values, size_t count);
+    // kept out of line, so that log() inlines to the level check
+    template <typename... Args>
+    __attribute__((noinline))
+    void logargs(int level, const char* format, const Args&... args);
+    void logvalues(int level, const char* format,
+                   const log_value_t* values, size_t count);
+    void emit(int level, const char* record, size_t len,
+              const char* json, size_t jlen);
+    bool suppressed(int level, const char* message, size_t len);
+    void log_repeated(int level, unsigned long count, size_t offset,
+                      bool queue=true);
+    // report repeats whose window is over at 'now' (LLONG_MAX: any). Only
+    // queued in asynchronous mode if 'queue' (callers holding a reference)
+    void report_repeats(long long now, bool queue=false);
+    void collect_tree(std::vector<logger_info_t>* tree,
+                      std::vector<logptr_t>* loggers);
+    static size_t format_timestamp(char* buf, size_t size,
+                      const char* timefmt, const struct timespec& ts,
+                      int precision);
+    uint32_t binlog_module();
+    void fill_entry(binlog_entry_t* entry, int level, uint32_t id);
+    void flight_text(int level, const char* message, size_t len);
+    void flight_values(int level, const char* format,
+                       const log_value_t* values, size_t count);
   public:
     // Constructors with opaque Private type argument not usable from outside 
     Logger(Private);
@@ -87,21 +209,161 @@ class Logger {
     // Regular logger
     static logptr_t get_logger(const std::string& module,
                                int level=UNCHANGED, int stream=UNCHANGED);
-    // Message formatting
-    void log(int level, const char* format, ...);
-    void critical(const char* format, ...);
-    void error(const char* format, ...);
-    void warning(const char* format, ...);
-    void info(const char* format, ...);
-    void debug(const char* format, ...);
+    // Whether a record would be written by this logger or its ancestors
+    bool enabled(int level) const {
+      return level >= efflevel.load(std::memory_order_relaxed);
+    }
+    // Whether a call must be looked at: written, or counted or kept by the
+    // flight recorder when filtered. Calls that are not return after this
+    // single load. Same as enabled() unless filtered calls are counted or
+    // the flight recorder is on
+    bool wanted(int level) const {
+      return level >= gatelevel.load(std::memory_order_relaxed);
+    }
+    // Message formatting. printf style formats with type safe arguments
+    // (see logformat.h). Addresses can be logged with '%s'
+    template <typename... Args>
+    void log(int level, const char* format, const Args&... args);
+    template <typename... Args>
+    void critical(const char* format, const Args&... args) {
+      log(CRITICAL, format, args...);
+    }
+    template <typename... Args>
+    void error(const char* format, const Args&... args) {
+      log(ERROR, format, args...);
+    }
+    template <typename... Args>
+    void warning(const char* format, const Args&... args) {
+      log(WARNING, format, args...);
+    }
+    template <typename... Args>
+    void info(const char* format, const Args&... args) {
+      log(INFO, format, args...);
+    }
+    template <typename... Args>
+    void debug(const char* format, const Args&... args) {
+      log(DEBUG, format, args...);
+    }
     // Get/set current log level
     int get_loglevel();
     int set_loglevel(int level);
     // Select log file and streamer
     void set_logfile(const std::string& fname);
+    std::string get_logfile();
     std::ostream* set_streamer(int streamval);
+    // Log file batching. Records are written once 'bytes' are pending,
+    // after 'msecs' or right away for records at 'level' or above
+    // 'bytes' = 0 writes every record as it comes
+    void set_batching(size_t bytes, unsigned int msecs, int level=ERROR);
+    // Log file rotation. The file is renamed to 'name.1' (older ones are
+    // shifted up to 'name.<keep>') once it reaches 'bytes' or is 'secs'
+    // old. 0 disables the limit. Done by a background thread
+    void set_rotation(unsigned long long bytes, unsigned int secs,
+                      unsigned int keep=SINK_ROTATE_KEEP);
+    // Ship records to a multicast group (see logmcast.h), through
+    // interface 'ifname' if given. An empty group stops shipping
+    // Returns false if the group cannot be used
+    bool set_multicast(const std::string& group, unsigned short port,
+                       const std::string& ifname="", int ttl=MCAST_TTL);
+    mcast_stats_t get_multicast_stats();
+    // Repeated message suppression. A message identical to the previous
+    // one of this logger (same level and text) within 'msecs' of its first
+    // occurrence is not written. The next different message, or the next
+    // repeat after 'msecs', is preceded by "last message repeated N times"
+    // Repeats followed by nothing are reported once 'msecs' are over, when
+    // the logger is destroyed and at exit
+    // 0 (default) writes every message
+    void set_suppression(unsigned int msecs);
+    // Same for a standard stream (STDOUT, STDERR, STDLOG). Applies to all
+    // loggers. Streams write every record as it comes by default
+    static void set_stream_batching(int streamval, size_t bytes,
+                                    unsigned int msecs, int level=ERROR);
+    // Record format of the log file and multicast shipping of this logger
+    // SINK_TEXT (default) or SINK_JSON, one JSON object per line (see
+    // logformat.h). Records are only formatted as JSON when a sink along
+    // the chain asks for it
+    void set_format(int format);
+    // Same for a standard stream. Applies to all loggers
+    static void set_stream_format(int streamval, int format);
+    // Extra field of the JSON records of this logger ("key":"value")
+    // An empty value removes the field
+    void set_field(const std::string& key, const std::string& value);
+    // Write pending records of this logger and its ancestors
+    void flush();
     // Control tree navigation
     bool set_propagation(bool mode);
+    // Binary logging. Write log calls made through LOG_BINARY to a memory
+    // mapped file as raw arguments, to be rendered by 'logdecode' later
+    // Format strings must be literals. Applies to all loggers
+    template <typename... Args>
+    void logbin(int level, std::atomic<uint32_t>& fid,
+                const char* format, const Args&... args);
+    static bool open_binlog(const std::string& fname, size_t size=BINLOG_SIZE);
+    static void close_binlog();
+    // Flight recorder. Keeps the last 'records' records of all loggers at
+    // any level in memory, whether they are written or not (see
+    // logflight.h). Records that are not written are stored unformatted
+    // Those of direct calls (debug(), info() ...) with arguments not fitting
+    // their format, or too large for a slot, are formatted
+    // The ring is written to 'crash_file' on fatal signals, if given, and
+    // to any file by dump_flight_recorder(). Use 'logdecode' to read it
+    template <typename... Args>
+    void logflight(int level, std::atomic<uint32_t>& fid,
+                   const char* format, const Args&... args);
+    static bool start_flight_recorder(size_t records=FLIGHT_RECORDS,
+                                      const std::string& crash_file="");
+    static void stop_flight_recorder();
+    static bool dump_flight_recorder(const std::string& fname);
+    // Timestamp precision for all loggers (TS_SECONDS ... TS_NANOSECONDS)
+    static int set_time_precision(int precision);
+    static int get_time_precision();
+    // Record layout (also used by offline tools)
+    static size_t format_header(char* buf, size_t size, const char* timefmt,
+                                const struct timespec& ts, int precision,
+                                const char* module, size_t modlen,
+                                const char* tag, size_t taglen, int level);
+    // "(name:tid) ", "(tid) " or nothing for the unnamed main thread
+    static size_t format_thread_tag(char* buf, size_t size,
+                                    unsigned int thread, const char* name);
+    // Thread identity. The kernel thread id of the calling thread, or 0
+    // for the main thread unless it was named. Worked out once per thread
+    static unsigned int get_thread_tag();
+    // Name the calling thread in its records ("rx-eth0-q3"). An empty
+    // name removes it
+    static void set_thread_name(const std::string& name);
+    static std::string get_thread_name();
+    // Level names ("debug" ... "critical"). string_to_level() also takes
+    // numbers and returns -1 for unknown names
+    static const char* level_to_string(int level);
+    static int string_to_level(const std::string& name);
+    // Runtime control. Existing loggers only: nothing gets created
+    // "root" names the root logger
+    static logptr_t lookup_logger(const std::string& module);
+    static std::vector<logger_info_t> get_logger_tree();
+    // Counters of this logger and of all loggers, parents first
+    log_counters_t get_counters() const { return counters.get(); }
+    static std::vector<logger_stats_t> get_logger_stats();
+    // Counting of calls the LOG_XXX macros do not pass on. Calls filtered
+    // out by the level are only counted when asked for, as counting them
+    // puts a shared increment on the path meant to cost nothing. Applies
+    // to all loggers
+    void count_filtered() {
+      if (filtered_counting.load(std::memory_order_relaxed))
+        counters.count_filtered();
+    }
+    void count_dropped()  { counters.count_dropped(); }
+    static void set_filtered_counting(bool mode);
+    static bool get_filtered_counting();
+    static void flush_all();
+    // Serve the control commands of logcontrol.h on a Unix domain socket
+    static bool start_control(const std::string& path);
+    static void stop_control();
+    // Asynchronous mode. Records are queued and written by a background
+    // thread. Applies to all loggers
+    static bool start_async(size_t qsize=ASYNC_QUEUE_SIZE,
+                            int policy=OVF_BLOCK);
+    static void stop_async();
+    static async_stats_t get_async_stats();
 };
 // 
 // These have wider scope than class typedefs
@@ -109,4 +371,202 @@ class Logger {
 typedef std::shared_ptr<Logger> logptr_t;
 typedef Logger&                 logref_t;
 
+// Text records. Arguments are passed to the formatter as typed values
+// Records below the effective level are not formatted: the flight
+// recorder keeps their raw values
+template <typename... Args>
+void Logger::log(int level, const char* format, const Args&... args) {
+
+  if (wanted(level))
+    logargs(level, format, args...);
+}
+
+template <typename... Args>
+void Logger::logargs(int level, const char* format, const Args&... args) {
+  log_value_t values[sizeof...(Args) + 1] = { log_value(args)... };
+
+  if (not enabled(level)) {
+    count_filtered();
+    flight_values(level, format, values, sizeof...(Args));
+    return;
+  }
+  logvalues(level, format, values, sizeof...(Args));
+}
+
+// Binary records. Nothing is formatted: the format number, timestamp and
+// raw arguments are copied into the binary log. Text records are written
+// instead if no binary log is open
+template <typename... Args>
+void Logger::logbin(int level, std::atomic<uint32_t>& fid,
+                    const char* format, const Args&... args) {
+  BinaryLog* blog = binlog_active();
+
+  if (not blog or not blog->acquire()) {
+    log(level, format, args...);
+    return;
+  }
+
+  // definitions must precede the first record using them
+  uint32_t id = fid.load(std::memory_order_acquire);
+  if (id == 0)
+    id = binlog_format_id(fid, format);
+  binlog_module();
+
+  binlog_entry_t* entry = blog->reserve(sizeof(binlog_entry_t) +
+                                        binlog_args_size(args...));
+  if (entry) {
+    fill_entry(entry, level, id);
+    binlog_put_args((char*) (entry + 1), args...);
+    blog->commit(entry, BL_RECORD);
+    counters.count_emitted(level, sizeof(binlog_entry_t) +
+                                  binlog_args_size(args...), -1);
+  }
+  else
+    counters.count_dropped();
+
+  blog->release();
+
+  logflight(level, fid, format, args...);
+}
+
+// Flight recorder records. Same layout as binary records
+template <typename... Args>
+void Logger::logflight(int level, std::atomic<uint32_t>& fid,
+                       const char* format, const Args&... args) {
+  FlightRecorder* recorder = flight_active();
+  uint64_t seq;
+
+  if (not recorder)
+    return;
+
+  uint32_t id = fid.load(std::memory_order_acquire);
+  if (id == 0)
+    id = binlog_format_id(fid, format);
+  binlog_module();
+
+  binlog_entry_t* entry = recorder->reserve(sizeof(binlog_entry_t) +
+                                            binlog_args_size(args...), seq);
+  if (entry) {
+    fill_entry(entry, level, id);
+    binlog_put_args((char*) (entry + 1), args...);
+    recorder->commit(seq);
+  }
+}
+
+// Compile time level selection
+//
+// Log calls below LOG_MIN_LEVEL compile to nothing. The remaining calls
+// cost a single load when the level is disabled at run time. They only
+// evaluate their arguments when the level is enabled, or when the flight
+// recorder is on (format strings must be literals then)
+// Release builds (NDEBUG) drop debug records unless told otherwise
+// Formats are checked against the argument types at compile time
+//
+//   LOG_DEBUG(logger_ptr, "created address: %s", addr);
+//
+#ifndef LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_MIN_LEVEL INFO
+#else
+#define LOG_MIN_LEVEL DEBUG
+#endif
+#endif
+
+#define LOG_AT(logger, level, ...)                                   \
+  do {                                                               \
+    LOG_CHECK_FORMAT(__VA_ARGS__);                                   \
+    static std::atomic<uint32_t> flight_fid(0);                      \
+    if ((level) < LOG_MIN_LEVEL or not (logger)->wanted(level))      \
+      break;                                                         \
+    if ((logger)->enabled(level))                                    \
+      (logger)->log((level), __VA_ARGS__);                           \
+    else {                                                           \
+      (logger)->count_filtered();                                    \
+      if (flight_active())                                           \
+        (logger)->logflight((level), flight_fid, __VA_ARGS__);       \
+    }                                                                \
+  } while (0)
+
+#define LOG_NOTHING(logger, ...) do { } while (0)
+
+#if LOG_MIN_LEVEL <= DEBUG
+#define LOG_DEBUG(logger, ...)    LOG_AT(logger, DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(logger, ...)    LOG_NOTHING(logger, __VA_ARGS__)
+#endif
+#if LOG_MIN_LEVEL <= INFO
+#define LOG_INFO(logger, ...)     LOG_AT(logger, INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(logger, ...)     LOG_NOTHING(logger, __VA_ARGS__)
+#endif
+#if LOG_MIN_LEVEL <= WARNING
+#define LOG_WARNING(logger, ...)  LOG_AT(logger, WARNING, __VA_ARGS__)
+#else
+#define LOG_WARNING(logger, ...)  LOG_NOTHING(logger, __VA_ARGS__)
+#endif
+#if LOG_MIN_LEVEL <= ERROR
+#define LOG_ERROR(logger, ...)    LOG_AT(logger, ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(logger, ...)    LOG_NOTHING(logger, __VA_ARGS__)
+#endif
+#define LOG_CRITICAL(logger, ...) LOG_AT(logger, CRITICAL, __VA_ARGS__)
+
+// Binary records (see Logger::logbin). Each call site gets a format number
+//
+//   LOG_BINARY(logger_ptr, DEBUG, "seq %u from %s", seq, source);
+//
+#define LOG_BINARY(logger, level, ...)                               \
+  do {                                                               \
+    LOG_CHECK_FORMAT(__VA_ARGS__);                                   \
+    static std::atomic<uint32_t> binlog_fid(0);                      \
+    if ((level) < LOG_MIN_LEVEL or not (logger)->wanted(level))      \
+      break;                                                         \
+    if ((logger)->enabled(level))                                    \
+      (logger)->logbin((level), binlog_fid, __VA_ARGS__);            \
+    else {                                                           \
+      (logger)->count_filtered();                                    \
+      if (flight_active())                                           \
+        (logger)->logflight((level), binlog_fid, __VA_ARGS__);       \
+    }                                                                \
+  } while (0)
+
+// Rate limited and sampled records (see loglimit.h), for hot paths. Each
+// call site gets its own limiter. A record let through after others were
+// suppressed is preceded by a "suppressed N messages" record
+//
+//   LOG_RATELIMIT(logger_ptr, WARNING, 10, 1000, "gap before seq %u", seq);
+//   LOG_SAMPLE(logger_ptr, DEBUG, 100, "datagram from %s", source);
+//
+#define LOG_RATELIMIT(logger, level, count, msecs, ...)              \
+  do {                                                               \
+    LOG_CHECK_FORMAT(__VA_ARGS__);                                   \
+    static LogRateLimiter log_limiter((count), (msecs));             \
+    unsigned long log_dropped = 0;                                   \
+    if ((level) < LOG_MIN_LEVEL or not (logger)->wanted(level))      \
+      break;                                                         \
+    if (not (logger)->enabled(level))                                \
+      (logger)->count_filtered();                                    \
+    else if (log_limiter.admit(log_dropped)) {                       \
+      if (log_dropped)                                               \
+        (logger)->log((level), "suppressed %lu messages", log_dropped); \
+      (logger)->log((level), __VA_ARGS__);                           \
+    }                                                                \
+    else                                                             \
+      (logger)->count_dropped();                                     \
+  } while (0)
+
+#define LOG_SAMPLE(logger, level, n, ...)                            \
+  do {                                                               \
+    LOG_CHECK_FORMAT(__VA_ARGS__);                                   \
+    static LogSampler log_sampler(n);                                \
+    if ((level) < LOG_MIN_LEVEL or not (logger)->wanted(level))      \
+      break;                                                         \
+    if (not (logger)->enabled(level))                                \
+      (logger)->count_filtered();                                    \
+    else if (log_sampler.admit())                                    \
+      (logger)->log((level), __VA_ARGS__);                           \
+    else                                                             \
+      (logger)->count_dropped();                                     \
+  } while (0)
+
 #endif
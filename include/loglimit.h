@@ -0,0 +1,85 @@
+#ifndef INC_LOGLIMIT
+#define INC_LOGLIMIT
+
+#include <atomic>
+
+#include "monoclock.h"
+
+// Rate limiting of a log call site
+//
+// A token bucket holding up to 'burst' records, refilled with 'count'
+// records every 'msecs'. It is kept as the time at which the bucket would
+// be full again (generic cell rate algorithm), so that taking a token is a
+// single compare and swap. Records finding the bucket empty are counted.
+// The next record let through reports how many were suppressed
+//
+class LogRateLimiter {
+  private:
+    std::atomic<long long>     full_at;     // nsecs. Bucket full from then on
+    std::atomic<unsigned long> suppressed;  // records dropped since the last
+    long long                  interval;    // nsecs per token
+    long long                  tolerance;   // nsecs worth of burst
+  public:
+    LogRateLimiter(unsigned int count, unsigned int msecs,
+                   unsigned int burst=0);
+    LogRateLimiter(LogRateLimiter const&) = delete;
+    void operator=(LogRateLimiter const&) = delete;
+    // Take a token. On success 'dropped' is set to the number of records
+    // suppressed since the previous success
+    bool admit(unsigned long& dropped);
+    // same at 'now' (mono_nsecs() time)
+    bool admit(unsigned long& dropped, long long now);
+};
+
+inline LogRateLimiter::LogRateLimiter(unsigned int count, unsigned int msecs,
+                                      unsigned int burst) :
+                                        full_at(0),
+                                        suppressed(0)  {
+
+  if (count == 0)
+    count = 1;
+  if (burst == 0)
+    burst = count;
+  interval  = (long long) msecs * 1000000 / count;
+  tolerance = interval * (burst - 1);
+}
+
+inline bool LogRateLimiter::admit(unsigned long& dropped) {
+  return admit(dropped, mono_nsecs());
+}
+
+inline bool LogRateLimiter::admit(unsigned long& dropped, long long now) {
+  long long full = full_at.load(std::memory_order_relaxed);
+
+  for (;;) {
+    long long start = full > now ? full : now;
+    if (start - now > tolerance) {                 // bucket empty
+      suppressed.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (full_at.compare_exchange_weak(full, start + interval,
+                                      std::memory_order_relaxed))
+      break;
+  }
+
+  dropped = suppressed.load(std::memory_order_relaxed) == 0 ? 0 :
+              suppressed.exchange(0, std::memory_order_relaxed);
+  return true;
+}
+
+// Sampling of a log call site. Lets through the first of every 'n' records
+//
+class LogSampler {
+  private:
+    std::atomic<unsigned long> calls;
+    unsigned long              n;
+  public:
+    explicit LogSampler(unsigned long n) : calls(0), n(n ? n : 1) {}
+    LogSampler(LogSampler const&)     = delete;
+    void operator=(LogSampler const&) = delete;
+    bool admit() {
+      return calls.fetch_add(1, std::memory_order_relaxed) % n == 0;
+    }
+};
+
+#endif
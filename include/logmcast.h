@@ -0,0 +1,93 @@
+#ifndef INC_LOGMCAST
+#define INC_LOGMCAST
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "logsink.h"
+
+// Log shipping to a multicast group
+//
+// Records are packed into UDP datagrams ('\n' terminated, after a small
+// header) and sent to a group, so that any number of nodes can publish
+// their logs and any number of collectors ('logcollect') can listen,
+// without connections. A datagram is sent once full, once its oldest
+// record is 'max_msecs' old, or right away for records at 'flush_level'
+// or above
+//
+// Writers never block: full datagrams wait in a bounded queue and are sent
+// with non-blocking calls by whichever thread gets there first. Records
+// are dropped (and counted) when the queue is full or the socket cannot
+// take a datagram. Collectors detect datagrams lost on the way from gaps
+// in the sequence numbers
+//
+#define MCAST_MAGIC          "MCLG"
+#define MCAST_DATAGRAM_SIZE  1400      // fits the usual MTU, no fragments
+#define MCAST_QUEUE_SIZE     64        // datagrams waiting to be sent
+#define MCAST_TTL            1         // hops (IPv4 TTL, IPv6 hop limit)
+
+// datagram header. Records follow
+typedef struct {
+  char     magic[4];                   // MCAST_MAGIC
+  uint32_t seq;                        // network byte order. Per sink
+} mcast_header_t;
+
+typedef struct {
+  unsigned long records;               // records sent
+  unsigned long datagrams;             // datagrams sent
+  unsigned long dropped;               // records dropped
+  unsigned long truncated;             // records cut to fit a datagram
+} mcast_stats_t;
+
+class McastSink : public LogSink {
+  private:
+    typedef struct {
+      std::string data;
+      unsigned    records;
+    } datagram_t;
+    int          fd;
+    struct sockaddr_storage group;
+    socklen_t    grouplen;
+    int          flush_level;
+    unsigned int max_msecs;
+    std::mutex   bufmutex;             // datagram being filled and queue
+    datagram_t   current;
+    long long    first_pending;        // when 'current' got its first record
+    std::deque<datagram_t> queue;      // full datagrams
+    std::mutex   iomutex;              // sending. Keeps datagrams in order
+    uint32_t     seq;                  // next sequence number (iomutex)
+    std::atomic<unsigned long> records;
+    std::atomic<unsigned long> datagrams;
+    std::atomic<unsigned long> dropped;
+    std::atomic<unsigned long> truncated;
+    //
+    void seal();
+    void send_queued(bool wait);
+  public:
+    McastSink(int fd, const struct sockaddr* group, socklen_t grouplen,
+              int flush_level, unsigned int max_msecs=SINK_BATCH_MSECS);
+    ~McastSink();
+    McastSink(McastSink const&)      = delete;
+    void operator=(McastSink const&) = delete;
+    void write(const char* record, size_t len, int level);
+    void flush();
+    void expire(long long now);
+    mcast_stats_t get_stats() const;
+    // Sink sending to 'group':'port'. The group is resolved by get_address()
+    // and 'ifname' (outgoing interface, default route if empty) by
+    // get_network_interfaces(). The zone of an IPv6 group stands for an
+    // empty 'ifname' and must match a given one. Returns nullptr on error
+    // (errno is set)
+    static std::shared_ptr<McastSink> open(const std::string& group,
+                                           unsigned short port,
+                                           const std::string& ifname,
+                                           int ttl, int flush_level);
+};
+
+#endif
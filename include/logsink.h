@@ -0,0 +1,115 @@
+#ifndef INC_LOGSINK
+#define INC_LOGSINK
+
+#include <stddef.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "monoclock.h"
+
+// default batching parameters for file sinks
+#define SINK_BATCH_BYTES  65536    // write once this many bytes are pending
+#define SINK_BATCH_MSECS  100      // or once the oldest record is this old
+#define SINK_FLUSH_TICK   10       // flusher thread period (msecs)
+// default number of rotated files kept (name.1 ... name.N)
+#define SINK_ROTATE_KEEP  5
+// record formats
+#define SINK_TEXT         0        // "timestamp module: (thread) [level] ..."
+#define SINK_JSON         1        // one JSON object per line (logformat.h)
+
+// An output for log records
+//
+class LogSink {
+  private:
+    std::atomic<int> format;
+  public:
+    LogSink() : format(SINK_TEXT) {};
+    virtual ~LogSink();
+    // write a record (no line terminator) logged at 'level'
+    virtual void write(const char* record, size_t len, int level) = 0;
+    // write pending records
+    virtual void flush() = 0;
+    // periodic work, done by the flusher thread for registered sinks
+    // 'now' is mono_msecs() time
+    virtual void expire(long long now);
+    // format of the records given to write() (SINK_XXX). Loggers pick the
+    // form of each record by the sinks along their chains
+    void set_format(int fmt) { format = fmt; }
+    int  get_format() const { return format.load(std::memory_order_relaxed); }
+};
+
+typedef std::shared_ptr<LogSink> sinkptr_t;
+
+// A sink writing to a file descriptor
+//
+// Records are gathered in a buffer and written with a single writev()
+// (group commit) when enough bytes are pending, when the oldest pending
+// record gets too old, when a record at 'flush_level' or above arrives, or
+// when flush() is called. With 'max_bytes' set to zero every record is
+// written right away (a single writev() per record)
+//
+// Sinks opened on a file can be rotated once the file reaches a size or an
+// age. Renaming and reopening are done by the flusher thread. Writers
+// only switch to the new descriptor, so they never wait on the file
+// system. The size limit is checked every flusher tick, so a file may
+// grow a bit beyond it
+//
+class FdSink : public LogSink {
+  private:
+    int          fd;             // guarded by iomutex
+    bool         owned;          // close the descriptor on destruction
+    std::string  path;           // file name, if opened by open_file()
+    size_t       max_bytes;
+    unsigned int max_msecs;
+    int          flush_level;
+    std::mutex   bufmutex;       // pending buffer
+    std::mutex   iomutex;        // writes. Keeps batches in order
+    std::mutex   rotatemutex;    // one rotation at a time
+    std::string  pending;        // records waiting to be written
+    std::string  writing;        // records being written
+    long long    first_pending;  // when the oldest pending record arrived
+    unsigned long long rotate_bytes;   // rotation (guarded by bufmutex)
+    unsigned int rotate_secs;
+    unsigned int rotate_keep;
+    long long    opened_at;      // when the current file was opened
+    std::atomic<unsigned long long> file_size;
+    //
+    void write_batch(const char* record, size_t len);
+    void rotate(long long now);
+  public:
+    FdSink(int fd, bool owned, int flush_level,
+           size_t max_bytes=SINK_BATCH_BYTES,
+           unsigned int max_msecs=SINK_BATCH_MSECS);
+    ~FdSink();
+    FdSink(FdSink const&)         = delete;
+    void operator=(FdSink const&) = delete;
+    void write(const char* record, size_t len, int level);
+    void flush();
+    void expire(long long now);
+    // flush if the oldest pending record is older than 'max_msecs'
+    void flush_expired(long long now);
+    void set_batching(size_t bytes, unsigned int msecs, int level);
+    // Rotate the file once it reaches 'bytes' or is 'secs' old (0 = never)
+    // keeping 'keep' previous files. Only for sinks made by open_file()
+    void set_rotation(unsigned long long bytes, unsigned int secs,
+                      unsigned int keep=SINK_ROTATE_KEEP);
+    // rotate if due (flusher thread, or any other)
+    void rotate_expired(long long now);
+    // open a file for appending. Returns nullptr on error (errno is set)
+    static std::shared_ptr<FdSink> open_file(const std::string& fname,
+                                             int flush_level);
+};
+
+// Sinks registered with the flusher thread get expire() calls every
+// SINK_FLUSH_TICK msecs and are flushed at exit. Unregister before
+// destruction
+void register_sink(LogSink* sink);
+void unregister_sink(LogSink* sink);
+
+// write pending records of every registered sink (e.g. at exit)
+void flush_all_sinks();
+
+#endif
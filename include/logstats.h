@@ -0,0 +1,113 @@
+#ifndef INC_LOGSTATS
+#define INC_LOGSTATS
+
+#include <stddef.h>
+
+#include <atomic>
+
+#include "monoclock.h"
+
+// Per logger counters
+//
+// Records written per level, calls filtered out by the level (if asked
+// for, see Logger::set_filtered_counting), bytes given to the sinks,
+// records dropped (asynchronous queue overflow, rate limited and sampled
+// call sites) or suppressed as repeats, and a histogram of the time spent
+// in the sinks per record. Counters are updated with relaxed
+// atomic increments and never locked. Each thread updates one of a few
+// copies (stripes), so that threads logging through the same logger do
+// not fight over a cache line. Reading sums the stripes
+//
+#define STATS_LEVELS   8          // indexed by level (NOTSET ... NOLOG)
+#define STATS_BUCKETS  32         // bucket i: [2^i, 2^(i+1)) nsecs
+#define STATS_STRIPES  8          // copies of the counters
+
+typedef struct {
+  unsigned long emitted[STATS_LEVELS];   // records written, per level
+  unsigned long filtered;                // calls below the effective level
+  unsigned long bytes;                   // bytes given to sinks
+  unsigned long dropped;                 // records lost on the way
+  unsigned long suppressed;              // repeats (see set_suppression)
+  unsigned long latency[STATS_BUCKETS];  // sink writes of a record
+} log_counters_t;
+
+// stripe of the calling thread. Threads take them in turns
+inline unsigned int stats_stripe() {
+  static std::atomic<unsigned int> next(0);
+  static thread_local unsigned int stripe = next++ % STATS_STRIPES;
+  return stripe;
+}
+
+class LogCounters {
+  private:
+    typedef struct {
+      std::atomic<unsigned long> emitted[STATS_LEVELS];
+      std::atomic<unsigned long> filtered;
+      std::atomic<unsigned long> bytes;
+      std::atomic<unsigned long> dropped;
+      std::atomic<unsigned long> suppressed;
+      std::atomic<unsigned long> latency[STATS_BUCKETS];
+    } stripe_t;
+    stripe_t stripes[STATS_STRIPES];
+    //
+    static void add(std::atomic<unsigned long>& counter, unsigned long n) {
+      counter.fetch_add(n, std::memory_order_relaxed);
+    }
+    stripe_t& mine() { return stripes[stats_stripe()]; }
+  public:
+    LogCounters();
+    LogCounters(LogCounters const&)    = delete;
+    void operator=(LogCounters const&) = delete;
+    void count_emitted(int level, size_t bytes, long long nsecs);
+    void count_filtered()                 { add(mine().filtered, 1); }
+    void count_dropped(unsigned long n=1) { add(mine().dropped, n); }
+    void count_suppressed()               { add(mine().suppressed, 1); }
+    log_counters_t get() const;
+};
+
+inline LogCounters::LogCounters() {
+
+  for (auto& s : stripes) {
+    for (auto& c : s.emitted)
+      c = 0;
+    s.filtered   = 0;
+    s.bytes      = 0;
+    s.dropped    = 0;
+    s.suppressed = 0;
+    for (auto& c : s.latency)
+      c = 0;
+  }
+}
+
+// 'nsecs' < 0: not timed
+inline void LogCounters::count_emitted(int level, size_t bytes,
+                                       long long nsecs) {
+  stripe_t& s = mine();
+
+  add(s.emitted[(unsigned) level % STATS_LEVELS], 1);
+  add(s.bytes, bytes);
+  if (nsecs < 0)
+    return;
+
+  int bucket = nsecs > 0 ? 63 - __builtin_clzll(nsecs) : 0;
+  add(s.latency[bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1], 1);
+}
+
+inline log_counters_t LogCounters::get() const {
+  log_counters_t total = {};
+
+  for (auto& s : stripes) {
+    for (int i=0; i<STATS_LEVELS; i++)
+      total.emitted[i] += s.emitted[i].load(std::memory_order_relaxed);
+    total.filtered   += s.filtered.load(std::memory_order_relaxed);
+    total.bytes      += s.bytes.load(std::memory_order_relaxed);
+    total.dropped    += s.dropped.load(std::memory_order_relaxed);
+    total.suppressed += s.suppressed.load(std::memory_order_relaxed);
+    for (int i=0; i<STATS_BUCKETS; i++)
+      total.latency[i] += s.latency[i].load(std::memory_order_relaxed);
+  }
+
+  return total;
+}
+
+#endif
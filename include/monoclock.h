@@ -0,0 +1,19 @@
+#ifndef INC_MONOCLOCK
+#define INC_MONOCLOCK
+
+#include <chrono>
+
+// Monotonic time (steady clock), as used for batching, rotation, repeat
+// suppression, rate limiting, latency counters and cache expiry. Values
+// only make sense as differences
+//
+inline long long mono_nsecs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline long long mono_msecs() {
+  return mono_nsecs() / 1000000;
+}
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef INC_RINGBUFFER
+#define INC_RINGBUFFER
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// A bounded lock-free queue (D. Vyukov's algorithm)
+//
+// Every cell carries a sequence number that tells producers and consumers
+// whether the cell is free to be filled or ready to be drained. Positions
+// are claimed with a CAS, so any number of threads may push and pop.
+// The logging writer is the usual (single) consumer, but producers may
+// also pop when they are asked to discard the oldest entry
+//
+// Cell contents are never moved in or out of the queue. Callers provide
+// a functor that fills or drains the cell in place, so that the storage
+// (e.g. a string capacity) is reused once the queue has been warmed up
+//
+template <typename T>
+class RingBuffer {
+  private:
+    struct Cell {
+      std::atomic<size_t> seq;
+      T                   data;
+    };
+    Cell*               cells;       // size is a power of two
+    size_t              mask;        // size - 1
+    char                pad0[64];    // keep positions in separate lines
+    std::atomic<size_t> enqueue_pos;
+    char                pad1[64];
+    std::atomic<size_t> dequeue_pos;
+    char                pad2[64];
+  public:
+    explicit RingBuffer(size_t size);
+    ~RingBuffer();
+    RingBuffer(RingBuffer const&)     = delete;
+    void operator=(RingBuffer const&) = delete;
+    // false if queue is full/empty. 'fill'/'take' are called as f(T&)
+    template <typename F> bool push(F fill);
+    template <typename F> bool pop(F take);
+    bool   empty() const;
+    size_t capacity() const;
+};
+
+template <typename T>
+RingBuffer<T>::RingBuffer(size_t size) : enqueue_pos(0), dequeue_pos(0) {
+  size_t n = 2;
+
+  // round up to the next power of two
+  while (n < size)
+    n <<= 1;
+
+  cells = new Cell[n];
+  mask  = n - 1;
+  for (size_t i=0; i<n; i++)
+    cells[i].seq.store(i, std::memory_order_relaxed);
+}
+
+template <typename T>
+RingBuffer<T>::~RingBuffer() {
+  delete[] cells;
+}
+
+template <typename T>
+template <typename F>
+bool RingBuffer<T>::push(F fill) {
+  Cell*  cell;
+  size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+  for (;;) {
+    cell = &cells[pos & mask];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+    if (dif == 0) {
+      // cell is free. Try to claim it
+      if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed))
+        break;
+    }
+    else if (dif < 0)
+      return false;                              // full
+    else
+      pos = enqueue_pos.load(std::memory_order_relaxed);
+  }
+
+  fill(cell->data);
+  cell->seq.store(pos + 1, std::memory_order_release);
+
+  return true;
+}
+
+template <typename T>
+template <typename F>
+bool RingBuffer<T>::pop(F take) {
+  Cell*  cell;
+  size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+
+  for (;;) {
+    cell = &cells[pos & mask];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    intptr_t dif = (intptr_t) seq - (intptr_t) (pos + 1);
+    if (dif == 0) {
+      // cell has been filled. Try to claim it
+      if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed))
+        break;
+    }
+    else if (dif < 0)
+      return false;                              // empty
+    else
+      pos = dequeue_pos.load(std::memory_order_relaxed);
+  }
+
+  take(cell->data);
+  cell->seq.store(pos + mask + 1, std::memory_order_release);
+
+  return true;
+}
+
+template <typename T>
+bool RingBuffer<T>::empty() const {
+  size_t pos = dequeue_pos.load(std::memory_order_acquire);
+
+  return cells[pos & mask].seq.load(std::memory_order_acquire) != pos + 1;
+}
+
+template <typename T>
+size_t RingBuffer<T>::capacity() const {
+  return mask + 1;
+}
+
+#endif
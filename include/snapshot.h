@@ -0,0 +1,96 @@
+#ifndef INC_SNAPSHOT
+#define INC_SNAPSHOT
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// A read-mostly value published as immutable snapshots
+//
+// Readers take no lock: they register in one of two counters, load the
+// current snapshot and use it for as long as the Reader object lives.
+// Writers copy the current snapshot, modify the copy and publish it. The
+// old snapshot is deleted once no reader can be using it anymore: the
+// writer flips the counter new readers register in and waits for the
+// other one to drain, twice (so readers that saw either parity are done)
+// Writers may wait for readers. Readers never wait
+//
+template <typename T>
+class Snapshot {
+  private:
+    std::atomic<T*>            current;
+    std::atomic<unsigned long> readers[2];
+    std::atomic<unsigned int>  epoch;
+    std::mutex                 writemutex;
+    //
+    void synchronize();
+  public:
+    class Reader {
+      private:
+        Snapshot&    snap;
+        unsigned int slot;
+        const T*     value;
+      public:
+        explicit Reader(Snapshot& s);
+        ~Reader();
+        Reader(Reader const&)         = delete;
+        void operator=(Reader const&) = delete;
+        const T* get() const        { return value; }
+        const T* operator->() const { return value; }
+        const T& operator*() const  { return *value; }
+    };
+    Snapshot();
+    ~Snapshot();
+    Snapshot(Snapshot const&)       = delete;
+    void operator=(Snapshot const&) = delete;
+    // copy, modify and publish. 'modify' is called as modify(T&)
+    template <typename F> void update(F modify);
+};
+
+template <typename T>
+Snapshot<T>::Snapshot() : current(new T()), epoch(0) {
+  readers[0] = 0;
+  readers[1] = 0;
+}
+
+template <typename T>
+Snapshot<T>::~Snapshot() {
+  delete current.load();
+}
+
+template <typename T>
+Snapshot<T>::Reader::Reader(Snapshot& s) : snap(s) {
+  slot  = snap.epoch.load() & 1;
+  snap.readers[slot]++;
+  value = snap.current.load();
+}
+
+template <typename T>
+Snapshot<T>::Reader::~Reader() {
+  snap.readers[slot]--;
+}
+
+template <typename T>
+void Snapshot<T>::synchronize() {
+
+  for (int i=0; i<2; i++) {
+    unsigned int e = epoch.load();
+    epoch.store(e + 1);
+    while (readers[e & 1].load() != 0)
+      std::this_thread::yield();
+  }
+}
+
+template <typename T>
+template <typename F>
+void Snapshot<T>::update(F modify) {
+
+  std::lock_guard<std::mutex> lock(writemutex);
+  T* next = new T(*current.load());
+  modify(*next);
+  T* old = current.exchange(next);
+  synchronize();
+  delete old;
+}
+
+#endif
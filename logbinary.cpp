@@ -0,0 +1,502 @@
+/*
+A multicast interface to the socket library
+
+  Binary logging
+
+    Records are stored as a format string id, a raw timestamp and the raw
+    argument bytes. No formatting takes place on the logging thread.
+    The 'logdecode' tool renders binary logs as text
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "logbinary.h"
+
+using namespace std;
+
+#define BINLOG_ALIGN(len)  (((len) + 7) & ~((size_t) 7))
+#define FORMAT_CACHE       64      // per thread entries, direct mapped
+#define FORMAT_CACHE_ARGS  19      // argument kinds kept by an entry
+
+//////////// BinaryLog class
+//
+BinaryLog::BinaryLog() : fd(-1),
+                         base(nullptr),
+                         size(0),
+                         tail(0),
+                         writers(0),
+                         closed(true),
+                         dropped(0)     {};
+
+BinaryLog::~BinaryLog() {
+  close();
+}
+
+// Create the log file with its final size and map it
+bool BinaryLog::open(const string& fname, size_t fsize) {
+  binlog_header_t* header;
+
+  if (fsize < sizeof(binlog_header_t) + sizeof(binlog_entry_t))
+    return false;
+
+  fd = ::open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+
+  if (ftruncate(fd, fsize) != 0) {
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+
+  void* p = mmap(nullptr, fsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+
+  base   = (char*) p;
+  size   = fsize;
+  header = (binlog_header_t*) base;
+  memcpy(header->magic, BINLOG_MAGIC, sizeof(header->magic));
+  header->version     = BINLOG_VERSION;
+  header->header_size = sizeof(binlog_header_t);
+  header->file_size   = fsize;
+
+  tail   = BINLOG_ALIGN(sizeof(binlog_header_t));
+  closed = false;
+
+  return true;
+}
+
+// Stop accepting entries, wait for writers and release the mapping
+// The file is cut down to the space actually used
+void BinaryLog::close() {
+
+  if (closed.exchange(true))
+    return;
+
+  while (writers > 0)
+    this_thread::yield();
+
+  size_t used = min(tail.load(), size);
+  msync(base, size, MS_SYNC);
+  munmap(base, size);
+  if (ftruncate(fd, used) != 0)
+    perror("binary log truncation");
+  ::close(fd);
+
+  base = nullptr;
+  fd   = -1;
+}
+
+bool BinaryLog::acquire() {
+
+  writers++;
+  if (closed) {
+    writers--;
+    return false;
+  }
+
+  return true;
+}
+
+void BinaryLog::release() {
+
+  writers--;
+}
+
+// Reserve room for an entry with 'len' bytes (header included)
+// Must be called between acquire() and release()
+binlog_entry_t* BinaryLog::reserve(size_t len) {
+
+  len = BINLOG_ALIGN(len);
+
+  size_t offset = tail.fetch_add(len, memory_order_relaxed);
+  if (offset + len > size) {
+    dropped++;
+    return nullptr;
+  }
+
+  auto entry = (binlog_entry_t*) (base + offset);
+  entry->size = len;
+
+  return entry;
+}
+
+// An entry is complete once its type is set
+void BinaryLog::commit(binlog_entry_t* entry, uint16_t type) {
+
+  __atomic_store_n(&entry->type, type, __ATOMIC_RELEASE);
+}
+
+void BinaryLog::define(uint16_t type, uint32_t id, const char* text) {
+  size_t len = strlen(text) + 1;
+
+  if (not acquire())
+    return;
+
+  binlog_entry_t* entry = reserve(sizeof(binlog_entry_t) + len);
+  if (entry) {
+    entry->id = id;
+    memcpy(entry + 1, text, len);
+    commit(entry, type);
+  }
+
+  release();
+}
+
+unsigned long BinaryLog::get_dropped() const {
+  return dropped;
+}
+
+size_t BinaryLog::get_used() const {
+  return min(tail.load(), size);
+}
+
+//////////// Process wide binary log and registries
+//
+// Closed logs are never deleted: a thread may still hold a pointer to
+// them (acquire() will fail). Only their mapping is released
+//
+static atomic<BinaryLog*> active_binlog(nullptr);
+static mutex              registry_mutex;
+static vector<const char*> formats;            // id - 1 -> format
+static vector<string>      modules;            // id - 1 -> module name
+static vector<pair<uint32_t, string>> threads; // thread tag, thread name
+static unordered_map<string, uint32_t> copied_formats;  // text -> id
+
+// Formats of direct calls seen by a thread, by address and argument kinds
+// Addresses may be reused for other texts: hits are checked against the
+// copy. 'copy' is nullptr for values that do not fit their format
+typedef struct {
+  const char* format;
+  const char* copy;
+  uint64_t    kinds;               // count, then 3 bits per argument
+  uint32_t    id;
+} format_cache_t;
+
+static thread_local format_cache_t format_cache[FORMAT_CACHE];
+
+BinaryLog* binlog_active() {
+  return active_binlog.load(memory_order_acquire);
+}
+
+bool binlog_open(const string& fname, size_t fsize) {
+  BinaryLog* blog = new BinaryLog();
+
+  if (not blog->open(fname, fsize)) {
+    delete blog;
+    return false;
+  }
+
+  lock_guard<mutex> lock(registry_mutex);
+
+  // known formats and modules are defined upfront
+  for (size_t i=0; i<formats.size(); i++)
+    blog->define(BL_FORMAT, i+1, formats[i]);
+  for (size_t i=0; i<modules.size(); i++)
+    blog->define(BL_MODULE, i+1, modules[i].c_str());
+  for (auto& thread : threads)
+    blog->define(BL_THREAD, thread.first, thread.second.c_str());
+
+  BinaryLog* old = active_binlog.exchange(blog);
+  if (old)
+    old->close();
+
+  return true;
+}
+
+void binlog_close() {
+
+  lock_guard<mutex> lock(registry_mutex);
+  BinaryLog* old = active_binlog.exchange(nullptr);
+  if (old)
+    old->close();
+}
+
+uint32_t binlog_format_id(atomic<uint32_t>& fid, const char* format) {
+
+  lock_guard<mutex> lock(registry_mutex);
+  uint32_t id = fid.load();
+  if (id == 0) {
+    formats.push_back(format);
+    id = formats.size();
+    BinaryLog* blog = active_binlog.load();
+    if (blog)
+      blog->define(BL_FORMAT, id, format);
+    fid.store(id, memory_order_release);
+  }
+
+  return id;
+}
+
+uint32_t binlog_values_format_id(const char* format,
+                                 const log_value_t* values, size_t count) {
+  if (count > FORMAT_CACHE_ARGS)
+    return 0;
+
+  uint64_t kinds = count;
+  for (size_t i=0; i<count; i++)
+    kinds |= (uint64_t) values[i].kind << (5 + 3 * i);
+
+  format_cache_t& entry =
+    format_cache[((uintptr_t) format >> 3 ^ kinds) % FORMAT_CACHE];
+  if (entry.format == format and entry.kinds == kinds and
+      (not entry.copy or strcmp(entry.copy, format) == 0))
+    return entry.id;
+
+  const char* copy = nullptr;
+  uint32_t    id   = 0;
+  if (log_format_fits(format, values, count)) {
+    lock_guard<mutex> lock(registry_mutex);
+    auto known = copied_formats.find(format);
+    if (known != copied_formats.end()) {
+      id   = known->second;
+      copy = formats[id - 1];
+    }
+    else if (copied_formats.size() < BINLOG_COPIED_FORMATS) {
+      copy = strdup(format);                     // never freed
+      formats.push_back(copy);
+      id = formats.size();
+      copied_formats[copy] = id;
+      BinaryLog* blog = active_binlog.load();
+      if (blog)
+        blog->define(BL_FORMAT, id, copy);
+    }
+  }
+  entry.format = format;
+  entry.copy   = copy;
+  entry.kinds  = kinds;
+  entry.id     = id;
+
+  return id;
+}
+
+uint32_t binlog_module_id(atomic<uint32_t>& mid, const string& name) {
+
+  lock_guard<mutex> lock(registry_mutex);
+  uint32_t id = mid.load();
+  if (id == 0) {
+    modules.push_back(name);
+    id = modules.size();
+    BinaryLog* blog = active_binlog.load();
+    if (blog)
+      blog->define(BL_MODULE, id, name.c_str());
+    mid.store(id, memory_order_release);
+  }
+
+  return id;
+}
+
+// A thread tag is defined again when the thread is renamed, or when a new
+// thread gets the same kernel thread id
+void binlog_thread_name(uint32_t thread, const string& name) {
+
+  lock_guard<mutex> lock(registry_mutex);
+  size_t i = 0;
+  while (i < threads.size() and threads[i].first != thread)
+    i++;
+  if (i == threads.size())
+    threads.push_back(make_pair(thread, name));
+  else
+    threads[i].second = name;
+
+  BinaryLog* blog = active_binlog.load();
+  if (blog)
+    blog->define(BL_THREAD, thread, name.c_str());
+}
+
+//////////// Typed values
+//
+size_t binlog_values_size(const log_value_t* values, size_t count) {
+  size_t len = 0;
+
+  for (size_t i=0; i<count; i++)
+    switch (values[i].kind) {
+      case LA_STRING:
+        len += 1 + 4 + values[i].len;
+        break;
+      case LA_ADDRESS:
+        len += 1 + 4 + ADDRESS_TEXT_SIZE;
+        break;
+      default:
+        len += 1 + 8;
+    }
+
+  return len;
+}
+
+// integers are kept sign or zero extended already
+char* binlog_put_values(char* p, const log_value_t* values, size_t count) {
+
+  for (size_t i=0; i<count; i++) {
+    const log_value_t& lv = values[i];
+    uint64_t slot;
+    uint32_t len;
+
+    switch (lv.kind) {
+      case LA_INT:
+        *p++ = BINLOG_TAG(LA_INT, lv.width, lv.is_signed);
+        memcpy(p, &lv.v.i, 8);
+        p += 8;
+        break;
+      case LA_FLOAT:
+        *p++ = BINLOG_TAG(LA_FLOAT, 0, false);
+        memcpy(p, &lv.v.d, 8);
+        p += 8;
+        break;
+      case LA_POINTER:
+        *p++ = BINLOG_TAG(LA_POINTER, 0, false);
+        slot = (uint64_t) (uintptr_t) lv.v.p;
+        memcpy(p, &slot, 8);
+        p += 8;
+        break;
+      case LA_STRING:
+        *p++ = BINLOG_TAG(LA_STRING, 0, false);
+        len = lv.len;
+        memcpy(p, &len, 4);
+        memcpy(p + 4, lv.v.s, len);
+        p += 4 + len;
+        break;
+      case LA_ADDRESS:
+        *p++ = BINLOG_TAG(LA_STRING, 0, false);
+        len = lv.v.p ? lv.format(lv.v.p, p + 4, ADDRESS_TEXT_SIZE) :
+                       strlen(strcpy(p + 4, BINLOG_NULL_STRING));
+        memcpy(p, &len, 4);
+        p += 4 + len;
+        break;
+    }
+  }
+
+  return p;
+}
+
+// write() until done. Async signal safe
+static bool write_all(int fd, const void* buf, size_t len) {
+  const char* p = (const char*) buf;
+
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 and errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p   += n;
+    len -= n;
+  }
+
+  return true;
+}
+
+static bool write_definition(int fd, uint16_t type, uint32_t id,
+                             const char* text) {
+  binlog_entry_t entry;
+  static const char zeros[8] = { 0 };
+  size_t len = strlen(text) + 1;
+
+  memset(&entry, 0, sizeof(entry));
+  entry.size = BINLOG_ALIGN(sizeof(entry) + len);
+  entry.type = type;
+  entry.id   = id;
+
+  return write_all(fd, &entry, sizeof(entry)) and
+         write_all(fd, text, len) and
+         write_all(fd, zeros, entry.size - sizeof(entry) - len);
+}
+
+bool binlog_write_preamble(int fd, bool wait) {
+  binlog_header_t header;
+  bool ok;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BINLOG_MAGIC, sizeof(header.magic));
+  header.version     = BINLOG_VERSION;
+  header.header_size = sizeof(binlog_header_t);
+  if (not write_all(fd, &header, sizeof(header)))
+    return false;
+
+  bool locked = wait;
+  if (wait)
+    registry_mutex.lock();
+  else
+    locked = registry_mutex.try_lock();
+
+  ok = true;
+  for (size_t i=0; ok and i<formats.size(); i++)
+    ok = write_definition(fd, BL_FORMAT, i+1, formats[i]);
+  for (size_t i=0; ok and i<modules.size(); i++)
+    ok = write_definition(fd, BL_MODULE, i+1, modules[i].c_str());
+  for (size_t i=0; ok and i<threads.size(); i++)
+    ok = write_definition(fd, BL_THREAD, threads[i].first,
+                          threads[i].second.c_str());
+
+  if (locked)
+    registry_mutex.unlock();
+
+  return ok;
+}
+
+//////////// Record rendering
+//
+// The tagged arguments are turned back into the typed values of the call
+// and formatted by log_format(), so that a decoded record reads exactly as
+// the text record of the same call
+//
+size_t binlog_render(char* buf, size_t size, const char* format,
+                     const char* args, size_t arglen) {
+  log_value_t values[BINLOG_RENDER_ARGS];
+  size_t      count = 0;
+  const char* p     = args;
+  const char* end   = args + arglen;
+
+  // records are padded: a zero tag ends the arguments. Stale bytes of a
+  // reused flight recorder slot only make values past the last conversion,
+  // which log_format() ignores
+  while (p < end and count < BINLOG_RENDER_ARGS) {
+    unsigned char tag = *p++;
+    log_value_t&  lv  = values[count];
+    uint32_t      len;
+
+    lv.kind = BINLOG_TAG_KIND(tag);
+    if (lv.kind == LA_STRING) {
+      if (end - p < 4)
+        break;
+      memcpy(&len, p, 4);
+      if ((size_t) (end - p - 4) < len)
+        break;
+      lv.v.s = p + 4;
+      lv.len = len;
+      p += 4 + len;
+    }
+    else if (lv.kind == LA_INT or lv.kind == LA_FLOAT or
+             lv.kind == LA_POINTER) {
+      if (end - p < 8)
+        break;
+      lv.is_signed = BINLOG_TAG_SIGNED(tag);
+      lv.width     = BINLOG_TAG_SIZE(tag);
+      memcpy(&lv.v, p, 8);
+      p += 8;
+    }
+    else
+      break;
+    count++;
+  }
+
+  return log_format(buf, size, format, values, count);
+}
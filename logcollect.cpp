@@ -0,0 +1,218 @@
+/*
+A multicast interface to the socket library
+
+  logcollect: writes out the records shipped to a multicast group
+
+    Joins the group and prints every record received, preceded by the
+    address and port of its sender. Datagrams lost on the way (gaps in
+    the sequence numbers of a sender) are reported on the standard error
+
+    usage: logcollect <group> <port> [<interface>]
+
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "address.h"
+#include "getifaddrs.h"
+#include "logformat.h"
+#include "logmcast.h"
+
+using namespace std;
+
+#define COLLECT_BUFFER_SIZE  65536
+#define COLLECT_RCVBUF       (4 << 20)   // absorbs bursts from many senders
+
+// a sender and the sequence number expected next from it
+typedef struct {
+  AddressValue   addr;
+  unsigned short port;
+  uint32_t       next_seq;
+  string         name;             // "address:port"
+} sender_t;
+
+static unsigned short sender_port(const struct sockaddr_storage& ss) {
+
+  if (ss.ss_family == AF_INET6)
+    return ntohs(((const struct sockaddr_in6*) &ss)->sin6_port);
+
+  return ntohs(((const struct sockaddr_in*) &ss)->sin_port);
+}
+
+// senders are few: a linear search of a contiguous table beats a map
+static sender_t& find_sender(vector<sender_t>& senders,
+                             const struct sockaddr_storage& ss,
+                             bool& found) {
+  AddressValue   addr = AddressValue::from_sockaddr((struct sockaddr*) &ss);
+  unsigned short port = sender_port(ss);
+
+  for (auto& sender : senders)
+    if (sender.port == port and sender.addr == addr) {
+      found = true;
+      return sender;
+    }
+
+  char text[ADDRESS_TEXT_SIZE];
+  addr.format(text, sizeof(text));
+  string name = addr.get_family() == AF_INET6 ?
+                  string("[") + text + "]:" + to_string(port) :
+                  string(text) + ":" + to_string(port);
+
+  found = false;
+  senders.push_back({ addr, port, 0, name });
+  return senders.back();
+}
+
+// join 'group' on 'ifname' (any interface if empty)
+static bool join_group(int fd, Address* group, const string& ifname) {
+  vector<NetworkInterface*> nis;
+  bool joined = false;
+
+  if (not ifname.empty())
+    nis = get_network_interfaces(ifname, group->get_family());
+
+  if (group->get_family() == AF_INET6) {
+    struct ipv6_mreq mreq;
+    memcpy(&mreq.ipv6mr_multiaddr, group->get_binaddr(),
+           sizeof(mreq.ipv6mr_multiaddr));
+    mreq.ipv6mr_interface = nis.empty() ? 0 : nis[0]->index;
+    joined = (ifname.empty() or not nis.empty()) and
+             setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP,
+                        &mreq, sizeof(mreq)) == 0;
+  }
+  else {
+    struct ip_mreq mreq;
+    memcpy(&mreq.imr_multiaddr, group->get_binaddr(),
+           sizeof(mreq.imr_multiaddr));
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    bool found = ifname.empty();
+    for (auto ni : nis)
+      for (auto addr : ni->addrvec)
+        if (not found and addr->get_family() == AF_INET) {
+          memcpy(&mreq.imr_interface, addr->get_binaddr(),
+                 sizeof(mreq.imr_interface));
+          found = true;
+        }
+    joined = found and setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                                  &mreq, sizeof(mreq)) == 0;
+  }
+
+  for (auto ni : nis) {
+    for (auto addr : ni->addrvec)
+      delete addr;
+    delete ni;
+  }
+
+  return joined;
+}
+
+int main(int argc, char* argv[]) {
+  struct sockaddr_storage local;
+  socklen_t               locallen;
+  vector<sender_t>        senders;
+  vector<char>            buf(COLLECT_BUFFER_SIZE);
+
+  if (argc < 3 or argc > 4 or atoi(argv[2]) <= 0 or atoi(argv[2]) > 65535) {
+    cerr << "usage: " << argv[0] << " <group> <port> [<interface>]" << endl;
+    return 2;
+  }
+  unsigned short port   = atoi(argv[2]);
+  string         ifname = argc > 3 ? argv[3] : "";
+
+  unique_ptr<Address> group(get_address(argv[1]));
+  if (not group or not group->is_multicast()) {
+    cerr << argv[0] << ": " << argv[1] << " is not a multicast group" << endl;
+    return 2;
+  }
+  int family = group->get_family();
+
+  // bound to any address, so that the group is received on any interface
+  memset(&local, 0, sizeof(local));
+  if (family == AF_INET6) {
+    auto sin6 = (struct sockaddr_in6*) &local;
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port   = htons(port);
+    sin6->sin6_addr   = in6addr_any;
+    locallen = sizeof(*sin6);
+  }
+  else {
+    auto sin = (struct sockaddr_in*) &local;
+    sin->sin_family      = AF_INET;
+    sin->sin_port        = htons(port);
+    sin->sin_addr.s_addr = htonl(INADDR_ANY);
+    locallen = sizeof(*sin);
+  }
+
+  int on = 1;
+  int fd = socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 or
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 or
+      bind(fd, (struct sockaddr*) &local, locallen) < 0) {
+    cerr << argv[0] << ": cannot listen on port " << port << ": "
+         << strerror(errno) << endl;
+    return 1;
+  }
+  int rcvbuf = COLLECT_RCVBUF;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  if (not join_group(fd, group.get(), ifname)) {
+    cerr << argv[0] << ": cannot join " << argv[1]
+         << (ifname.empty() ? "" : " on " + ifname) << endl;
+    return 1;
+  }
+
+  for (;;) {
+    struct sockaddr_storage from;
+    socklen_t fromlen = sizeof(from);
+    mcast_header_t header;
+
+    ssize_t n = recvfrom(fd, buf.data(), buf.size(), 0,
+                         (struct sockaddr*) &from, &fromlen);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      cerr << argv[0] << ": " << strerror(errno) << endl;
+      return 1;
+    }
+    if ((size_t) n < sizeof(header))
+      continue;
+    memcpy(&header, buf.data(), sizeof(header));
+    if (memcmp(header.magic, MCAST_MAGIC, sizeof(header.magic)) != 0)
+      continue;
+
+    bool      known;
+    sender_t& sender = find_sender(senders, from, known);
+    uint32_t  seq    = ntohl(header.seq);
+    if (known and seq != sender.next_seq)
+      cerr << argv[0] << ": " << sender.name << ": lost "
+           << (uint32_t) (seq - sender.next_seq) << " datagram(s)" << endl;
+    sender.next_seq = seq + 1;
+
+    // one line per record
+    const char* p   = buf.data() + sizeof(header);
+    const char* end = buf.data() + n;
+    while (p < end) {
+      const char* eol = (const char*) memchr(p, '\n', end - p);
+      if (not eol)
+        eol = end;
+      cout << sender.name << ' ';
+      cout.write(p, eol - p);
+      cout << '\n';
+      p = eol + 1;
+    }
+    cout.flush();
+  }
+
+  return 0;
+}
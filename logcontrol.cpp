@@ -0,0 +1,309 @@
+/*
+A multicast interface to the socket library
+
+  Runtime control of the loggers
+
+    A Unix domain socket served by a background thread. Commands are
+    described in logcontrol.h
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logcontrol.h"
+#include "logging.h"
+
+using namespace std;
+
+//////////// Commands
+//
+static const char* stream_names[] = { "none", "stdout", "stderr", "stdlog" };
+
+static vector<string> split(const string& line) {
+  vector<string> words;
+  istringstream iss(line);
+  string word;
+
+  while (iss >> word)
+    words.push_back(word);
+
+  return words;
+}
+
+// a logger changed by a command, in its own log
+static void audit(const logptr_t& logger, const string& command) {
+
+  logger->info("control: %s", command);
+}
+
+string control_execute(const string& command) {
+  vector<string> words = split(command);
+  ostringstream  reply;
+
+  if (words.empty())
+    return "error: empty command\n";
+  const string& cmd = words[0];
+
+  if (cmd == "help" and words.size() == 1) {
+    reply << "list\n"
+          << "stats [filtered on|off]\n"
+          << "level <module> <level>\n"
+          << "propagate <module> on|off\n"
+          << "stream <module> stdout|stderr|stdlog|none\n"
+          << "file <module> [<path>]\n"
+          << "flush [<module>]\n";
+  }
+  else if (cmd == "list" and words.size() == 1) {
+    for (auto& info : Logger::get_logger_tree())
+      reply << info.module << ' '
+            << Logger::level_to_string(info.level) << ' '
+            << (info.efflevel > MAXLOG ? "none" :
+                  Logger::level_to_string(info.efflevel)) << ' '
+            << (info.propagate ? "on" : "off") << ' '
+            << stream_names[info.stream] << ' '
+            << (info.logfile.empty() ? "-" : info.logfile) << '\n';
+  }
+  else if (cmd == "stats" and words.size() == 1) {
+    for (auto& stats : Logger::get_logger_stats()) {
+      const log_counters_t& c = stats.counters;
+      unsigned long records = 0;
+      for (auto n : c.emitted)
+        records += n;
+      reply << stats.module << ' ' << records << ' ' << c.bytes << ' '
+            << c.filtered << ' ' << c.suppressed << ' ' << c.dropped << '\n';
+    }
+  }
+  else if (cmd == "stats" and words.size() == 3 and words[1] == "filtered") {
+    if (words[2] != "on" and words[2] != "off")
+      return "error: stats filtered takes on or off\n";
+    Logger::set_filtered_counting(words[2] == "on");
+  }
+  else if (cmd == "flush" and words.size() == 1) {
+    Logger::flush_all();
+  }
+  else if ((cmd == "level" and words.size() == 3) or
+           (cmd == "propagate" and words.size() == 3) or
+           (cmd == "stream" and words.size() == 3) or
+           (cmd == "file" and (words.size() == 2 or words.size() == 3)) or
+           (cmd == "flush" and words.size() == 2)) {
+    logptr_t logger = Logger::lookup_logger(words[1]);
+    if (not logger)
+      return "error: no logger " + words[1] + "\n";
+
+    if (cmd == "level") {
+      int level = Logger::string_to_level(words[2]);
+      if (level < 0)
+        return "error: unknown level " + words[2] + "\n";
+      logger->set_loglevel(level);
+    }
+    else if (cmd == "propagate") {
+      if (words[2] != "on" and words[2] != "off")
+        return "error: propagate takes on or off\n";
+      logger->set_propagation(words[2] == "on");
+    }
+    else if (cmd == "stream") {
+      int stream = -1;
+      for (int i=0; i<4; i++)
+        if (words[2] == stream_names[i])
+          stream = i;
+      if (stream < 0)
+        return "error: unknown stream " + words[2] + "\n";
+      logger->set_streamer(stream);
+    }
+    else if (cmd == "file") {
+      string fname = words.size() == 3 ? words[2] : "";
+      logger->set_logfile(fname);
+      if (not fname.empty() and logger->get_logfile().empty())
+        return "error: cannot open " + fname + "\n";
+    }
+    else
+      logger->flush();
+
+    if (cmd != "flush")
+      audit(logger, command);
+  }
+  else
+    return "error: bad command " + cmd + " (try help)\n";
+
+  reply << "ok\n";
+  return reply.str();
+}
+
+//////////// Control server
+//
+// Clients are served one at a time. One that sends nothing for
+// CONTROL_IDLE_MSECS, or does not read its replies, is dropped so that the
+// next one gets its turn. A pipe wakes the thread up to stop
+//
+class ControlServer {
+  private:
+    string path;
+    int    listenfd;
+    int    wakefd[2];
+    thread server;
+    //
+    void run();
+    void serve(int fd);
+    bool wait_readable(int fd, int msecs);
+  public:
+    ControlServer() : listenfd(-1) {};
+    ~ControlServer();
+    ControlServer(ControlServer const&) = delete;
+    void operator=(ControlServer const&) = delete;
+    bool start(const string& sockpath);
+};
+
+bool ControlServer::start(const string& sockpath) {
+  struct sockaddr_un addr;
+
+  if (sockpath.empty() or sockpath.size() >= sizeof(addr.sun_path))
+    return false;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, sockpath.c_str());
+
+  listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listenfd < 0)
+    return false;
+
+  // a socket left behind by a previous run. Anything else is left alone
+  struct stat st;
+  if (lstat(sockpath.c_str(), &st) == 0) {
+    if (not S_ISSOCK(st.st_mode)) {
+      close(listenfd);
+      listenfd = -1;
+      return false;
+    }
+    unlink(sockpath.c_str());
+  }
+  mode_t mask = umask(0077);
+  int rc = bind(listenfd, (struct sockaddr*) &addr, sizeof(addr));
+  umask(mask);
+
+  if (rc < 0 or listen(listenfd, CONTROL_CLIENTS) < 0 or
+      pipe2(wakefd, O_CLOEXEC) < 0) {
+    close(listenfd);
+    listenfd = -1;
+    return false;
+  }
+
+  path   = sockpath;
+  server = thread(&ControlServer::run, this);
+
+  return true;
+}
+
+ControlServer::~ControlServer() {
+
+  if (listenfd < 0)
+    return;
+
+  char c = 0;
+  if (write(wakefd[1], &c, 1) < 0)
+    perror("control server wake up");
+  server.join();
+
+  close(listenfd);
+  close(wakefd[0]);
+  close(wakefd[1]);
+  unlink(path.c_str());
+}
+
+// false when told to stop or after 'msecs' (-1: no limit)
+bool ControlServer::wait_readable(int fd, int msecs) {
+  struct pollfd fds[2] = { { fd, POLLIN, 0 }, { wakefd[0], POLLIN, 0 } };
+
+  for (;;) {
+    int n = poll(fds, 2, msecs);
+    if (n < 0 and errno == EINTR)
+      continue;
+    return n > 0 and not fds[1].revents;
+  }
+}
+
+void ControlServer::run() {
+
+  Logger::set_thread_name("logctl");
+
+  while (wait_readable(listenfd, -1)) {
+    int fd = accept4(listenfd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0)
+      continue;
+    struct timeval tv = { CONTROL_IDLE_MSECS / 1000,
+                          CONTROL_IDLE_MSECS % 1000 * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    serve(fd);
+    close(fd);
+  }
+}
+
+// one command per line until the client hangs up or goes idle
+void ControlServer::serve(int fd) {
+  string pending;
+  char   buf[CONTROL_LINE_SIZE];
+
+  while (wait_readable(fd, CONTROL_IDLE_MSECS)) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 and errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
+    pending.append(buf, n);
+
+    size_t eol;
+    while ((eol = pending.find('\n')) != string::npos) {
+      string reply = control_execute(pending.substr(0, eol));
+      pending.erase(0, eol + 1);
+      if (send(fd, reply.data(), reply.size(), MSG_NOSIGNAL) < 0)
+        return;
+    }
+    if (pending.size() > CONTROL_LINE_SIZE) {
+      const char* reply = "error: command too long\n";
+      send(fd, reply, strlen(reply), MSG_NOSIGNAL);
+      return;
+    }
+  }
+}
+
+//////////// Process wide control server
+//
+static mutex          control_mutex;
+static ControlServer* control_server = nullptr;
+
+bool control_start(const string& path) {
+
+  lock_guard<mutex> lock(control_mutex);
+  if (control_server)
+    return false;
+
+  control_server = new ControlServer();
+  if (not control_server->start(path)) {
+    delete control_server;
+    control_server = nullptr;
+    return false;
+  }
+
+  return true;
+}
+
+void control_stop() {
+
+  lock_guard<mutex> lock(control_mutex);
+  delete control_server;
+  control_server = nullptr;
+}
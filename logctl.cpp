@@ -0,0 +1,75 @@
+/*
+A multicast interface to the socket library
+
+  logctl: sends a command to the control socket of a running process
+
+    The command is made of the remaining arguments (see logcontrol.h)
+    Exits with 0 if the command succeeded
+
+    usage: logctl <socket> <command> [<args>]
+
+      logctl /run/app.logctl level rx.eth0 debug
+      logctl /run/app.logctl list
+
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <iostream>
+#include <string>
+
+#include "logcontrol.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+  struct sockaddr_un addr;
+  string command;
+  string reply;
+  char   buf[CONTROL_LINE_SIZE];
+
+  if (argc < 3 or strlen(argv[1]) >= sizeof(addr.sun_path)) {
+    cerr << "usage: " << argv[0] << " <socket> <command> [<args>]" << endl;
+    return 2;
+  }
+
+  for (int i=2; i<argc; i++)
+    command += string(i > 2 ? " " : "") + argv[i];
+  command += '\n';
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, argv[1]);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 or connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+    cerr << argv[0] << ": cannot connect to " << argv[1] << ": "
+         << strerror(errno) << endl;
+    return 2;
+  }
+
+  // one command, then the reply until the server hangs up
+  if (write(fd, command.data(), command.size()) != (ssize_t) command.size() or
+      shutdown(fd, SHUT_WR) < 0) {
+    cerr << argv[0] << ": " << strerror(errno) << endl;
+    return 2;
+  }
+  for (;;) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 and errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    reply.append(buf, n);
+  }
+  close(fd);
+
+  cout << reply;
+
+  return reply.size() >= 3 and reply.compare(reply.size() - 3, 3, "ok\n") == 0 ?
+           0 : 1;
+}
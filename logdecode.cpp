@@ -0,0 +1,133 @@
+/*
+A multicast interface to the socket library
+
+  logdecode: renders a binary log file as text
+
+    The output matches the records the loggers would have written in text
+    mode. Timestamps are rendered in the local time zone of the decoder
+    Flight recorder dumps are binary logs too
+
+    usage: logdecode <binary log file>
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "logbinary.h"
+#include "logging.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+  map<uint32_t, string> formats;
+  map<uint32_t, string> modules;
+  map<uint32_t, string> threads;
+  binlog_header_t header;
+
+  if (argc != 2) {
+    cerr << "usage: " << argv[0] << " <binary log file>" << endl;
+    return 1;
+  }
+
+  ifstream ifs(argv[1], ios::binary);
+  if (not ifs.is_open()) {
+    cerr << argv[0] << ": cannot open " << argv[1] << ": "
+         << strerror(errno) << endl;
+    return 1;
+  }
+  string data((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+
+  if (data.size() < sizeof(header)) {
+    cerr << argv[0] << ": " << argv[1] << ": file too short" << endl;
+    return 1;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  if (memcmp(header.magic, BINLOG_MAGIC, sizeof(header.magic)) != 0) {
+    cerr << argv[0] << ": " << argv[1] << ": not a binary log file" << endl;
+    return 1;
+  }
+  if (header.version != BINLOG_VERSION) {
+    cerr << argv[0] << ": " << argv[1] << ": binary log version "
+         << header.version << ", expected " << BINLOG_VERSION << endl;
+    return 1;
+  }
+
+  vector<char> hbuf(LOG_HEADER_SIZE);
+  vector<char> mbuf(LOG_RECORD_SIZE);
+  size_t offset = (header.header_size + 7) & ~((size_t) 7);
+
+  while (offset + sizeof(binlog_entry_t) <= data.size()) {
+    binlog_entry_t entry;
+
+    memcpy(&entry, data.data() + offset, sizeof(entry));
+    if (entry.size == 0)
+      break;                                       // end of log
+    if (entry.size < sizeof(entry) or entry.size > data.size() - offset) {
+      cerr << argv[0] << ": corrupt entry at offset " << offset << endl;
+      return 1;
+    }
+
+    const char* payload = data.data() + offset + sizeof(entry);
+    size_t      paylen  = entry.size - sizeof(entry);
+
+    switch (entry.type) {
+      case BL_FORMAT:
+        formats[entry.id] = string(payload, strnlen(payload, paylen));
+        break;
+      case BL_MODULE:
+        modules[entry.id] = string(payload, strnlen(payload, paylen));
+        break;
+      case BL_THREAD:
+        threads[entry.id] = string(payload, strnlen(payload, paylen));
+        break;
+      case BL_RECORD: {
+        struct timespec ts;
+        ts.tv_sec  = entry.sec;
+        ts.tv_nsec = entry.nsec;
+
+        const string& module = modules[entry.module];
+        char   tag[THREAD_TAG_SIZE];
+        auto   name = threads.find(entry.thread);
+        size_t tlen = Logger::format_thread_tag(tag, sizeof(tag), entry.thread,
+                        name == threads.end() ? "" : name->second.c_str());
+        size_t hlen = Logger::format_header(hbuf.data(), hbuf.size(), TIMEFMT,
+                                            ts, entry.precision,
+                                            module.data(), module.size(),
+                                            tag, tlen, entry.level);
+
+        auto fmt = formats.find(entry.id);
+        if (fmt == formats.end()) {
+          snprintf(mbuf.data(), mbuf.size(), "<unknown format %u>", entry.id);
+        }
+        else {
+          size_t mlen = binlog_render(mbuf.data(), mbuf.size(),
+                                      fmt->second.c_str(), payload, paylen);
+          if (mlen >= mbuf.size()) {
+            mbuf.resize(mlen + 1);
+            binlog_render(mbuf.data(), mbuf.size(),
+                          fmt->second.c_str(), payload, paylen);
+          }
+        }
+
+        cout.write(hbuf.data(), hlen);
+        cout << mbuf.data() << '\n';
+        break;
+      }
+      default:                                     // incomplete entry
+        break;
+    }
+
+    offset += entry.size;
+  }
+
+  return 0;
+}
@@ -0,0 +1,179 @@
+/*
+A multicast interface to the socket library
+
+  Flight recorder
+
+    The last records logged at any level, kept in memory and written out
+    as a binary log after an incident. See logflight.h
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "logflight.h"
+
+using namespace std;
+
+#define FLIGHT_ALIGN(len)  (((len) + 7) & ~((size_t) 7))
+
+//////////// FlightRecorder class
+//
+FlightRecorder::FlightRecorder(size_t records) : count(records),
+                                                 head(0),
+                                                 dropped(0)     {
+
+  slots = new flight_slot_t[count];
+  for (size_t i=0; i<count; i++)
+    slots[i].stamp = 0;
+}
+
+binlog_entry_t* FlightRecorder::reserve(size_t len, uint64_t& seq) {
+
+  len = FLIGHT_ALIGN(len);
+  if (len > FLIGHT_SLOT_SIZE) {
+    dropped++;
+    return nullptr;
+  }
+
+  seq = head.fetch_add(1, memory_order_relaxed);
+  flight_slot_t& slot = slots[seq % count];
+  slot.stamp.store(2 * seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  auto entry = (binlog_entry_t*) slot.data;
+  entry->size = len;
+
+  return entry;
+}
+
+void FlightRecorder::commit(uint64_t seq) {
+  flight_slot_t& slot = slots[seq % count];
+  auto entry = (binlog_entry_t*) slot.data;
+  uint64_t busy = 2 * seq + 1;
+
+  entry->type = BL_RECORD;
+  // a late writer does not mark a reused slot as complete
+  slot.stamp.compare_exchange_strong(busy, busy + 1, memory_order_release);
+}
+
+// Oldest records first. A slot is copied out, then kept only if it was
+// not being rewritten meanwhile
+bool FlightRecorder::dump(int fd) {
+  char     data[FLIGHT_SLOT_SIZE];
+  uint64_t last  = head.load(memory_order_acquire);
+  uint64_t first = last > count ? last - count : 0;
+
+  for (uint64_t seq = first; seq < last; seq++) {
+    flight_slot_t& slot = slots[seq % count];
+
+    if (slot.stamp.load(memory_order_acquire) != 2 * seq + 2)
+      continue;
+    memcpy(data, slot.data, sizeof(data));
+    atomic_thread_fence(memory_order_acquire);
+    if (slot.stamp.load(memory_order_relaxed) != 2 * seq + 2)
+      continue;
+
+    auto   entry = (binlog_entry_t*) data;
+    size_t len   = entry->size;
+    if (len < sizeof(binlog_entry_t) or len > sizeof(data))
+      continue;
+
+    const char* p = data;
+    while (len > 0) {
+      ssize_t n = write(fd, p, len);
+      if (n < 0 and errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      p   += n;
+      len -= n;
+    }
+  }
+
+  return true;
+}
+
+unsigned long FlightRecorder::get_dropped() const {
+  return dropped;
+}
+
+//////////// Process wide flight recorder
+//
+atomic<FlightRecorder*> active_flight(nullptr);
+
+static mutex            flight_mutex;
+static atomic<FlightRecorder*> last_flight(nullptr);  // kept while stopped
+static char             crash_file[PATH_MAX];
+static const int        fatal_signals[] = { SIGSEGV, SIGBUS, SIGFPE,
+                                            SIGILL, SIGABRT };
+
+static bool dump_file(const char* fname, bool wait) {
+  FlightRecorder* recorder = last_flight.load();
+
+  if (not recorder)
+    return false;
+
+  int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+
+  bool ok = binlog_write_preamble(fd, wait) and recorder->dump(fd);
+  close(fd);
+
+  return ok;
+}
+
+bool flight_dump(const char* fname) {
+
+  return dump_file(fname, true);
+}
+
+// Write the ring and die from the signal, as we would have
+static void flight_crash(int sig) {
+
+  if (crash_file[0])
+    dump_file(crash_file, false);
+
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+bool flight_start(size_t records, const string& fname) {
+
+  if (records == 0 or fname.size() >= sizeof(crash_file))
+    return false;
+
+  lock_guard<mutex> lock(flight_mutex);
+  if (not last_flight.load())
+    last_flight = new FlightRecorder(records);
+
+  if (not fname.empty()) {
+    struct sigaction sa;
+
+    strcpy(crash_file, fname.c_str());
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = flight_crash;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags   = SA_RESETHAND;
+    for (int sig : fatal_signals)
+      sigaction(sig, &sa, nullptr);
+  }
+
+  active_flight.store(last_flight.load(), memory_order_release);
+
+  return true;
+}
+
+void flight_stop() {
+
+  active_flight.store(nullptr, memory_order_release);
+}
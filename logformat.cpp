@@ -0,0 +1,518 @@
+/*
+A multicast interface to the socket library
+
+  Type safe formatting of log messages
+
+    Arguments come as typed values (see logformat.h). Plain integer and
+    string conversions are written directly. Anything with flags, width
+    or precision goes through snprintf, one conversion at a time, with a
+    spec built for the kind of the argument. Arguments that do not fit
+    their conversion (only possible for calls not checked at compile
+    time) are shown as "%!d(string=text)" and never reach snprintf
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "logformat.h"
+
+using namespace std;
+
+#define SPEC_SIZE  64              // room for a single conversion spec
+#define SPEC_TAIL  4               // 'll', the conversion and the NUL
+
+// Output buffer. Keeps counting past the end, as snprintf
+class LogOutput {
+  private:
+    char*  buf;
+    size_t size;
+    size_t pos;
+  public:
+    LogOutput(char* buf, size_t size) : buf(buf), size(size), pos(0) {};
+    void append(const char* text, size_t len) {
+      if (pos < size)
+        memcpy(buf + pos, text, min(len, size - pos));
+      pos += len;
+    }
+    void append(char c) {
+      if (pos < size)
+        buf[pos] = c;
+      pos++;
+    }
+    // a single snprintf conversion, written in place
+    template <typename V>
+    void print(const char* spec, V v) {
+      int n = snprintf(pos < size ? buf + pos : nullptr,
+                       pos < size ? size - pos : 0, spec, v);
+      if (n > 0)
+        pos += n;
+    }
+    size_t finish() {
+      if (size > 0)
+        buf[min(pos, size - 1)] = '\0';
+      return pos;
+    }
+};
+
+static const char digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+// decimal digits of 'v', written backwards from 'end'. Returns the start
+static char* format_decimal(char* end, uint64_t v) {
+  char* p = end;
+
+  while (v >= 100) {
+    const char* pair = digit_pairs + 2 * (v % 100);
+    v /= 100;
+    *--p = pair[1];
+    *--p = pair[0];
+  }
+  if (v >= 10) {
+    const char* pair = digit_pairs + 2 * v;
+    *--p = pair[1];
+    *--p = pair[0];
+  }
+  else
+    *--p = '0' + v;
+
+  return p;
+}
+
+static char* format_hex(char* end, uint64_t v, bool upper) {
+  const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+  char* p = end;
+
+  do {
+    *--p = digits[v & 0xf];
+    v >>= 4;
+  } while (v);
+
+  return p;
+}
+
+// An integer converted as printf would for its type, except that unsigned
+// values are never shown as negative numbers
+static void put_int(LogOutput& out, char* spec, size_t slen, bool plain,
+                    const char* lenmod, char conv, const log_value_t& lv) {
+  uint64_t v     = lv.v.i;
+  int      width = lv.width;
+  bool     sgn   = lv.is_signed;
+
+  // 'hh' and 'h' narrow the value
+  if (lenmod[0] == 'h') {
+    width = lenmod[1] == 'h' ? 1 : 2;
+    sgn   = sgn or conv == 'd' or conv == 'i';
+  }
+  if (width < 8) {
+    uint64_t mask = (1ULL << (8 * width)) - 1;
+    v &= mask;
+    if (sgn and (conv == 'd' or conv == 'i') and (v >> (8 * width - 1)))
+      v |= ~mask;                                  // sign extension
+  }
+  bool negative = sgn and (conv == 'd' or conv == 'i') and (int64_t) v < 0;
+
+  if (conv == 'c' and plain) {
+    out.append((char) v);
+    return;
+  }
+
+  if (plain) {
+    char  digits[24];
+    char* end = digits + sizeof(digits);
+    char* p;
+
+    switch (conv) {
+      case 'd': case 'i': case 'u':
+        p = format_decimal(end, negative ? 0 - v : v);
+        if (negative)
+          *--p = '-';
+        out.append(p, end - p);
+        return;
+      case 'x': case 'X':
+        p = format_hex(end, v, conv == 'X');
+        out.append(p, end - p);
+        return;
+    }
+  }
+
+  if (conv == 'c') {
+    spec[slen++] = 'c';
+    spec[slen]   = '\0';
+    out.print(spec, (int) (unsigned char) v);
+    return;
+  }
+
+  // unsigned values too large for a signed conversion
+  if ((conv == 'd' or conv == 'i') and not negative and (int64_t) v < 0)
+    conv = 'u';
+
+  spec[slen++] = 'l';
+  spec[slen++] = 'l';
+  spec[slen++] = conv;
+  spec[slen]   = '\0';
+  if (conv == 'd' or conv == 'i')
+    out.print(spec, (long long) v);
+  else
+    out.print(spec, (unsigned long long) v);
+}
+
+static void put_string(LogOutput& out, char* spec, size_t slen, bool plain,
+                       const char* s, size_t len) {
+
+  if (plain) {
+    out.append(s, len);
+    return;
+  }
+
+  spec[slen++] = 's';
+  spec[slen]   = '\0';
+  out.print(spec, s);
+}
+
+static const char* kind_names[] = { "other", "int", "float", "string",
+                                    "pointer", "address" };
+
+// An argument that does not fit its conversion, with its own text
+static void put_mismatch(LogOutput& out, char conv, const log_value_t& lv) {
+  char   text[LOG_ADDRESS_SIZE];
+  char*  end = text + sizeof(text);
+  char*  p;
+  bool   negative;
+
+  out.append("%!", 2);
+  out.append(conv);
+  out.append('(');
+  out.append(kind_names[lv.kind], strlen(kind_names[lv.kind]));
+  out.append('=');
+  switch (lv.kind) {
+    case LA_INT:
+      negative = lv.is_signed and (int64_t) lv.v.i < 0;
+      p = format_decimal(end, negative ? 0 - lv.v.i : lv.v.i);
+      if (negative)
+        *--p = '-';
+      out.append(p, end - p);
+      break;
+    case LA_FLOAT:
+      out.print("%g", lv.v.d);
+      break;
+    case LA_STRING:
+      out.append(lv.v.s, lv.len);
+      break;
+    case LA_POINTER:
+      out.print("%p", lv.v.p);
+      break;
+    case LA_ADDRESS:
+      if (lv.v.p)
+        out.append(text, lv.format(lv.v.p, text, sizeof(text)));
+      else
+        out.append("(null)", 6);
+      break;
+  }
+  out.append(')');
+}
+
+size_t log_format(char* buf, size_t size, const char* format,
+                  const log_value_t* values, size_t count) {
+  LogOutput   out(buf, size);
+  const char* f    = format;
+  size_t      next = 0;
+
+  while (*f) {
+    const char* pct = strchr(f, '%');
+    if (not pct) {
+      out.append(f, strlen(f));
+      break;
+    }
+    out.append(f, pct - f);
+    f = pct + 1;
+
+    if (*f == '%') {
+      out.append('%');
+      f++;
+      continue;
+    }
+
+    // flags, width and precision are kept in 'spec', leaving room for
+    // its tail. What does not fit is dropped. Values for '*' are taken
+    // from the arguments
+    char   spec[SPEC_SIZE];
+    size_t slen  = 0;
+    bool   plain = true;
+    auto   add   = [&](char c) {
+      if (slen < SPEC_SIZE - SPEC_TAIL)
+        spec[slen++] = c;
+    };
+
+    add('%');
+    while (*f and strchr("-+ #0'", *f)) {
+      if (not memchr(spec, *f, slen))             // repeats change nothing
+        add(*f);
+      f++;
+      plain = false;
+    }
+    for (int part=0; part<2; part++) {
+      if (part == 1) {
+        if (*f != '.')
+          break;
+        add(*f++);
+        plain = false;
+      }
+      if (*f == '*') {
+        char digits[12];
+        int  v = 0;
+        if (next < count and values[next].kind == LA_INT)
+          v = (int) values[next].v.i;
+        next++;
+        snprintf(digits, sizeof(digits), "%d", v);
+        for (char* d = digits; *d; d++)
+          add(*d);
+        f++;
+        plain = false;
+      }
+      while (log_is_digit(*f)) {
+        add(*f++);
+        plain = false;
+      }
+    }
+
+    char   lenmod[4] = { 0 };
+    size_t llen      = 0;
+    while (log_is_lenmod(*f)) {
+      if (llen < sizeof(lenmod) - 1)
+        lenmod[llen++] = *f;
+      f++;
+    }
+
+    char conv = *f;
+    if (not conv)
+      break;
+    f++;
+
+    if (next >= count)                             // missing argument
+      continue;
+    const log_value_t& lv = values[next++];
+
+    if (not log_conv_ok(conv, lv.kind)) {
+      put_mismatch(out, conv, lv);
+      continue;
+    }
+    switch (lv.kind) {
+      case LA_INT:
+        put_int(out, spec, slen, plain, lenmod, conv, lv);
+        break;
+      case LA_FLOAT:
+        spec[slen++] = conv;
+        spec[slen]   = '\0';
+        out.print(spec, lv.v.d);
+        break;
+      case LA_STRING:
+        put_string(out, spec, slen, plain, lv.v.s, lv.len);
+        break;
+      case LA_POINTER:
+        spec[slen++] = 'p';
+        spec[slen]   = '\0';
+        out.print(spec, lv.v.p);
+        break;
+      case LA_ADDRESS: {
+        char   text[LOG_ADDRESS_SIZE];
+        size_t tlen;
+        if (lv.v.p)
+          tlen = lv.format(lv.v.p, text, sizeof(text));
+        else
+          tlen = strlen(strcpy(text, "(null)"));
+        put_string(out, spec, slen, plain, text, tlen);
+        break;
+      }
+    }
+  }
+
+  return out.finish();
+}
+
+bool log_format_fits(const char* format, const log_value_t* values,
+                     size_t count) {
+  const char* f    = format;
+  size_t      next = 0;
+
+  while ((f = strchr(f, '%'))) {
+    f++;
+    if (*f == '%') {
+      f++;
+      continue;
+    }
+    while (log_is_flag(*f))
+      f++;
+    for (int part=0; part<2; part++) {
+      if (part == 1) {
+        if (*f != '.')
+          break;
+        f++;
+      }
+      if (*f == '*') {
+        if (next >= count or values[next++].kind != LA_INT)
+          return false;
+        f++;
+      }
+      while (log_is_digit(*f))
+        f++;
+    }
+    while (log_is_lenmod(*f))
+      f++;
+    if (next >= count or not log_conv_ok(*f, values[next++].kind))
+      return false;
+    f++;
+  }
+
+  return next == count;
+}
+
+//////////// JSON records
+//
+// bytes that cannot appear as they are in a JSON string: controls, '"'
+// and '\\'. Their escapes, or 'u' for the \u00XX form
+static const char json_escapes[256] = {
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  0,   0,   '"', 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '\\', 0,  0,   0,
+};
+
+// runs of plain bytes are copied at once
+static void put_json_text(LogOutput& out, const char* text, size_t len) {
+  const char* end = text + len;
+
+  while (text < end) {
+    const char* run = text;
+    while (text < end and not json_escapes[(unsigned char) *text])
+      text++;
+    out.append(run, text - run);
+    if (text == end)
+      break;
+
+    unsigned char c   = *text++;
+    char          esc = json_escapes[c];
+    if (esc == 'u') {
+      char hex[6] = { '\\', 'u', '0', '0', "0123456789abcdef"[c >> 4],
+                      "0123456789abcdef"[c & 0xf] };
+      out.append(hex, sizeof(hex));
+    }
+    else {
+      out.append('\\');
+      out.append(esc);
+    }
+  }
+}
+
+static void put_json_string(LogOutput& out, const char* text, size_t len) {
+
+  out.append('"');
+  put_json_text(out, text, len);
+  out.append('"');
+}
+
+static void put_json_value(LogOutput& out, const log_value_t& lv) {
+  char  digits[24];
+  char* end = digits + sizeof(digits);
+  char* p;
+
+  switch (lv.kind) {
+    case LA_INT:
+      // signed values come sign extended
+      if (lv.is_signed and (int64_t) lv.v.i < 0) {
+        p = format_decimal(end, 0 - lv.v.i);
+        *--p = '-';
+      }
+      else
+        p = format_decimal(end, lv.v.i);
+      out.append(p, end - p);
+      break;
+    case LA_FLOAT:
+      if (lv.v.d - lv.v.d == 0)                    // not inf or nan
+        out.print("%.17g", lv.v.d);
+      else
+        out.append("null", 4);
+      break;
+    case LA_STRING:
+      put_json_string(out, lv.v.s, lv.len);
+      break;
+    case LA_POINTER:
+      p = format_hex(end, (uintptr_t) lv.v.p, false);
+      out.append("\"0x", 3);
+      out.append(p, end - p);
+      out.append('"');
+      break;
+    case LA_ADDRESS:
+      if (lv.v.p) {
+        char text[LOG_ADDRESS_SIZE];
+        put_json_string(out, text, lv.format(lv.v.p, text, sizeof(text)));
+      }
+      else
+        out.append("null", 4);
+      break;
+    default:
+      out.append("null", 4);
+  }
+}
+
+size_t log_json_escape(char* buf, size_t size, const char* text, size_t len) {
+  LogOutput out(buf, size);
+
+  put_json_text(out, text, len);
+
+  return out.finish();
+}
+
+size_t log_json_record(char* buf, size_t size, const log_json_t& record) {
+  LogOutput out(buf, size);
+  char      digits[24];
+  char*     end = digits + sizeof(digits);
+  char*     p;
+
+  out.append("{\"ts\":", 6);
+  p = format_decimal(end, record.ts.tv_sec);
+  out.append(p, end - p);
+  if (record.precision > 0) {
+    // nanoseconds, cut to the precision
+    p = format_decimal(end, record.ts.tv_nsec + 1000000000L);
+    *p = '.';
+    out.append(p, 1 + min(record.precision, 9));
+  }
+
+  out.append(",\"module\":", 10);
+  put_json_string(out, record.module, record.modlen);
+
+  out.append(",\"thread\":", 10);
+  p = format_decimal(end, record.thread);
+  out.append(p, end - p);
+  if (record.thread_name[0]) {
+    out.append(",\"thread_name\":", 15);
+    put_json_string(out, record.thread_name, strlen(record.thread_name));
+  }
+
+  out.append(",\"level\":\"", 10);
+  out.append(record.level, strlen(record.level));
+  out.append("\",\"message\":", 12);
+  put_json_string(out, record.message, record.msglen);
+
+  if (record.count) {
+    out.append(",\"args\":[", 9);
+    for (size_t i=0; i<record.count; i++) {
+      if (i)
+        out.append(',');
+      put_json_value(out, record.values[i]);
+    }
+    out.append(']');
+  }
+
+  out.append(record.fields, record.fieldslen);
+  out.append('}');
+
+  return out.finish();
+}
@@ -9,15 +9,24 @@ A multicast interface to the socket library
 */
 
 #include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
 #include <ctime>
 #include <cstdarg>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 
+#include "logcontrol.h"
 #include "logging.h"
+#include "ringbuffer.h"
 
 using namespace std;
 
@@ -50,6 +59,291 @@ static bool root_debug = false;
 static unsigned int max_submod = MAX_MODULE_SUBFIELDS;
 static unsigned int max_modlen = MODULE_NAME_SIZE;
 
+// number of sub-second digits in timestamps
+static atomic<int> time_precision(TS_SECONDS);
+
+// Per thread timestamp cache
+// The calendar part of a timestamp changes once per second, so localtime_r()
+// and strftime() run at most once per second in each thread. Sub-second
+// digits are appended to the cached text on every record
+struct TimeCache {
+  time_t      sec;                  // second currently formatted
+  const char* timefmt;              // format used
+  size_t      len;
+  char        text[48];
+};
+
+static thread_local TimeCache timecache = { -1, nullptr, 0, "" };
+
+// Per thread identity
+// Worked out the first time a thread logs: the kernel thread id is looked
+// up and the record tag formatted once. Records just copy the tag. A
+// plain struct, so that it needs no construction and outlives the other
+// thread_local objects
+struct ThreadTag {
+  bool         known;
+  unsigned int tid;                 // kernel thread id
+  unsigned int tag;                 // tid, or 0 for the unnamed main thread
+  size_t       len;
+  char         text[THREAD_TAG_SIZE];
+  char         name[THREAD_NAME_SIZE];
+};
+
+static thread_local ThreadTag threadtag = { false, 0, 0, 0, "", "" };
+
+// Per thread record buffer
+// Records are formatted in place. The buffer grows as needed and keeps its
+// capacity, so no memory gets allocated once a thread has logged its
+// longest record. It is a plain struct rather than a string because
+// loggers may still log from static destructors, after the main thread's
+// thread_local objects have been destroyed
+struct RecordBuffer {
+  char*  data;
+  size_t size;
+};
+
+static thread_local RecordBuffer recbuf = { nullptr, 0 };
+
+static thread_local struct RecordBufferGuard {
+  ~RecordBufferGuard() {
+    free(recbuf.data);
+    recbuf.data = nullptr;
+    recbuf.size = 0;
+  }
+} recbuf_guard;
+
+///////////// Asynchronous mode
+//
+// Producers format their records and queue them in a lock-free ring.
+// A single writer thread drains the ring and writes the records to the
+// streams and files of the loggers, so that I/O never happens on the
+// producers' threads
+// The writer object is created once and never destroyed, so that late
+// producers (e.g. loggers destroyed at exit) never see a dangling object
+//
+#define ASYNC_IDLE_WAIT_MS 100
+
+struct AsyncRecord {
+  logptr_t logger;          // keeps the logger alive until it is written
+  int      level;
+  string   record;          // text form, then JSON form if any
+  size_t   textlen;
+};
+
+class AsyncWriter {
+  private:
+    RingBuffer<AsyncRecord>* ring;
+    int                policy;
+    thread             writer;
+    atomic<bool>       running;     // queue accepts new records
+    atomic<int>        producers;   // threads currently inside push()
+    atomic<bool>       idle;        // writer is waiting for records
+    mutex              wakemutex;   // writer wake up
+    condition_variable wakeup;
+    mutex              ctlmutex;    // start/stop serialization
+    atomic<unsigned long> queued;
+    atomic<unsigned long> written;
+    atomic<unsigned long> dropped_newest;
+    atomic<unsigned long> dropped_oldest;
+    //
+    void run();
+    void drain();
+  public:
+    AsyncWriter();
+    bool start(size_t qsize, int pol);
+    void stop();
+    bool push(Logger* logger, int level, const char* record, size_t len,
+              size_t jlen);
+    async_stats_t stats();
+};
+
+// set in the writer thread. Records logged from there are never queued
+static thread_local bool in_async_writer = false;
+
+static AsyncWriter& async_writer() {
+  static AsyncWriter* instance = new AsyncWriter();
+  return *instance;
+}
+
+static void stop_async_at_exit() {
+  async_writer().stop();
+}
+
+AsyncWriter::AsyncWriter() : ring(nullptr),
+                             policy(OVF_BLOCK),
+                             running(false),
+                             producers(0),
+                             idle(false),
+                             queued(0),
+                             written(0),
+                             dropped_newest(0),
+                             dropped_oldest(0) {};
+
+bool AsyncWriter::start(size_t qsize, int pol) {
+  static bool exit_handler = false;
+
+  lock_guard<mutex> lock(ctlmutex);
+  if (running or pol < OVF_BLOCK or pol > OVF_DROP_OLDEST)
+    return false;
+
+  // pending records must be written before the loggers get destroyed
+  if (not exit_handler)
+    exit_handler = atexit(stop_async_at_exit) == 0;
+
+  ring    = new RingBuffer<AsyncRecord>(qsize);
+  policy  = pol;
+  running = true;
+  writer  = thread(&AsyncWriter::run, this);
+
+  return true;
+}
+
+void AsyncWriter::stop() {
+
+  lock_guard<mutex> lock(ctlmutex);
+  if (not running)
+    return;
+
+  // new records are logged synchronously from now on. The writer
+  // exits once the producers have left and the ring is empty
+  running = false;
+  {
+    lock_guard<mutex> wlock(wakemutex);
+    wakeup.notify_one();
+  }
+  writer.join();
+
+  delete ring;
+  ring = nullptr;
+}
+
+// Queue a formatted record ('len' bytes of text, then 'jlen' bytes of
+// JSON). Returns false if the record must be written synchronously by the
+// caller
+bool AsyncWriter::push(Logger* logger, int level,
+                       const char* record, size_t len, size_t jlen) {
+
+  if (in_async_writer or not running.load(memory_order_relaxed))
+    return false;
+
+  producers++;
+  if (not running) {
+    producers--;
+    return false;
+  }
+
+  logptr_t lp = logger->shared_from_this();
+  auto fill = [&](AsyncRecord& ar) {
+    ar.logger = lp;
+    ar.level  = level;
+    ar.record.assign(record, len + jlen); // reuses the cell's capacity
+    ar.textlen = len;
+  };
+
+  bool done = ring->push(fill);
+  while (not done) {
+    if (policy == OVF_DROP_NEWEST) {
+      dropped_newest++;
+      logger->counters.count_dropped();
+      break;
+    }
+    if (policy == OVF_DROP_OLDEST) {
+      logptr_t evicted;
+      if (ring->pop([&](AsyncRecord& ar) { evicted.swap(ar.logger); })) {
+        dropped_oldest++;
+        evicted->counters.count_dropped();
+      }
+    }
+    else                                 // OVF_BLOCK
+      this_thread::yield();
+    done = ring->push(fill);
+  }
+  if (done)
+    queued++;
+  producers--;
+
+  // wake up the writer if it is waiting for records
+  atomic_thread_fence(memory_order_seq_cst);
+  if (done and idle) {
+    lock_guard<mutex> wlock(wakemutex);
+    wakeup.notify_one();
+  }
+
+  return true;
+}
+
+void AsyncWriter::drain() {
+  logptr_t lp;
+  int      level   = NOTSET;
+  size_t   textlen = 0;
+  string   record;
+
+  auto take = [&](AsyncRecord& ar) {
+    lp.swap(ar.logger);
+    level   = ar.level;
+    textlen = ar.textlen;
+    record.swap(ar.record);             // both buffers keep their capacity
+  };
+
+  while (ring->pop(take)) {
+    lp->emit(level, record.data(), textlen, record.data() + textlen,
+             record.size() - textlen);
+    lp.reset();                         // may destroy the logger
+    written++;
+  }
+}
+
+void AsyncWriter::run() {
+
+  in_async_writer = true;
+
+  for (;;) {
+    drain();
+
+    // no more records can be queued once producers have left
+    if (not running and producers == 0 and ring->empty())
+      break;
+
+    unique_lock<mutex> lock(wakemutex);
+    idle = true;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (running and ring->empty())
+      wakeup.wait_for(lock, chrono::milliseconds(ASYNC_IDLE_WAIT_MS));
+    idle = false;
+  }
+
+  in_async_writer = false;
+}
+
+async_stats_t AsyncWriter::stats() {
+  async_stats_t st;
+
+  st.queued         = queued;
+  st.written        = written;
+  st.dropped_newest = dropped_newest;
+  st.dropped_oldest = dropped_oldest;
+
+  return st;
+}
+
+// Sinks for the standard streams, shared by all loggers
+// They are never destroyed, as loggers may log during static destruction
+// STDERR and STDLOG both write to the standard error
+//
+static shared_ptr<FdSink> stream_sink(int streamval) {
+  static auto out = new shared_ptr<FdSink>(
+                          make_shared<FdSink>(STDOUT_FILENO, false, ERROR, 0, 0));
+  static auto err = new shared_ptr<FdSink>(
+                          make_shared<FdSink>(STDERR_FILENO, false, ERROR, 0, 0));
+
+  switch(streamval) {
+    case STDOUT:   return *out;
+    case STDERR:
+    case STDLOG:   return *err;
+    default:       return nullptr;
+  }
+}
+
 ///////////// Logger class
 //
 // Logger instances are created on a per-module basis
@@ -72,19 +366,58 @@ static unsigned int max_modlen = MODULE_NAME_SIZE;
 Logger::Logger(Private) : modname(""),
                           loglevel(WARNING),
                           outstream(nullptr),
+                          batch_bytes(SINK_BATCH_BYTES),
+                          batch_msecs(SINK_BATCH_MSECS),
+                          flush_level(ERROR),
+                          rotate_bytes(0),
+                          rotate_secs(0),
+                          rotate_keep(SINK_ROTATE_KEEP),
+                          record_format(SINK_TEXT),
                           propagate(false),
-                          parent(nullptr)      { };
+                          parent(nullptr),
+                          dying(false),
+                          efflevel(NOLOG),
+                          gatelevel(NOLOG),
+                          jsonchain(false),
+                          binmodule(0),
+                          repeat_msecs(0),
+                          repeat_hash(0),
+                          repeat_level(NOTSET),
+                          repeat_since(0),
+                          repeats(0)           { };
 
 // non-root Logger constructor
 Logger::Logger(Private, const string& module) : modname(module),
                                                 loglevel(NOTSET),
                                                 outstream(nullptr),
-                                                propagate(true)       { };
+                                                batch_bytes(SINK_BATCH_BYTES),
+                                                batch_msecs(SINK_BATCH_MSECS),
+                                                flush_level(ERROR),
+                                                rotate_bytes(0),
+                                                rotate_secs(0),
+                                                rotate_keep(SINK_ROTATE_KEEP),
+                                                record_format(SINK_TEXT),
+                                                propagate(true),
+                                                dying(false),
+                                                efflevel(NOLOG),
+                                                gatelevel(NOLOG),
+                                                jsonchain(false),
+                                                binmodule(0),
+                                                repeat_msecs(0),
+                                                repeat_hash(0),
+                                                repeat_level(NOTSET),
+                                                repeat_since(0),
+                                                repeats(0)            { };
 
 // Destructor. Update loggers tree and close log file
 Logger::~Logger() {
   string module = modname;
 
+  // nobody else holds a pointer to us. Log synchronously from now on
+  repeat_reporter.reset();
+  dying = true;
+  report_repeats(LLONG_MAX);
+
   lock_guard<mutex> lock(treemutex);
 
   if (not parent) {                               // root
@@ -114,10 +447,11 @@ Logger::~Logger() {
           parent.reset();                     // cancel pointer to parent
           debug("parent removed"); 
           // close log file
-          if (logfile.is_open())
-            logfile.close();
+          logfile.reset();
           if (root_debug)
             set_root_debug();
+          else
+            update_routes(route_list_t());    // own sinks only
           debug("tree update complete");
       }
       else {
@@ -134,32 +468,87 @@ logptr_t Logger::get_logger(int level, int stream) {
 // *** Used exclusively for creating the root instance ***
 // Instance gets created and initialized the first time this method is called
 // The root instance is unique. This method always return the same pointer
+// Initialization of a local static is thread safe (C++11). Other threads
+// wait until the instance is created
 //
-  static logptr_t root_instance = nullptr;
-  mutex rootmutex;
-
-  lock_guard<mutex> lock(rootmutex);
-  if (not root_instance) {
-    main_thread_id = this_thread::get_id();
-    root_instance = make_shared<Logger>(Private());
-    if (level == ROOT_DEBUG) {
-      root_debug = true;
-      max_submod = ROOT_DEBUG_MAX_MODULE_SUBFIELDS;
-      max_modlen = ROOT_DEBUG_MODULE_NAME_SIZE;
-      root_instance->set_root_debug();
-    }
-    root_instance->info("root logging instance created");
-  }
-  else {
+  bool created = false;
+  static logptr_t root_instance = create_root(level, created);
+
+  if (not created) {
     root_instance->set_loglevel(level);
     root_instance->set_streamer(stream);
   }
 
   return root_instance;
 }
+// create and initialize the root instance
+logptr_t Logger::create_root(int level, bool& created) {
+  logptr_t root_instance;
+
+  main_thread_id = this_thread::get_id();
+  root_instance = make_shared<Logger>(Private());
+  if (level == ROOT_DEBUG) {
+    root_debug = true;
+    max_submod = ROOT_DEBUG_MAX_MODULE_SUBFIELDS;
+    max_modlen = ROOT_DEBUG_MODULE_NAME_SIZE;
+    root_instance->set_root_debug();
+  }
+  root_instance->info("root logging instance created");
+  created = true;
+
+  return root_instance;
+}
+// Registry of loggers by full module name
+// Published as immutable snapshots, so that looking up an existing logger
+// takes no lock. Entries of destroyed loggers expire and are dropped
+// whenever a new logger is registered. Never destroyed, as loggers may be
+// requested during static destruction
+//
+Snapshot<Logger::logmap_t>& Logger::registry() {
+  static auto instance = new Snapshot<logmap_t>();
+  return *instance;
+}
 //
 logptr_t Logger::get_logger(const string& module, int level, int stream) {
   logptr_t  instance;
+
+  // fast path. The logger exists
+  if (level != ROOT_DEBUG) {
+    {
+      Snapshot<logmap_t>::Reader loggers(registry());
+      auto entry = loggers->find(module);
+      if (entry != loggers->end())
+        instance = entry->second.lock();
+    }
+    if (instance) {
+      instance->set_loglevel(level);
+      instance->set_streamer(stream);
+      return instance;
+    }
+  }
+
+  // slow path. Walk the tree creating the missing loggers
+  instance = find_logger(module, level);
+
+  registry().update([&](logmap_t& loggers) {
+    for (auto entry = loggers.begin(); entry != loggers.end(); ) {
+      if (entry->second.expired())
+        entry = loggers.erase(entry);
+      else
+        entry++;
+    }
+    loggers[module] = instance;
+  });
+
+  // outside the tree lock, as this may update the effective levels
+  instance->set_loglevel(level);
+  instance->set_streamer(stream);
+
+  return instance;
+}
+// Look a module up in the loggers tree, creating the missing loggers
+logptr_t Logger::find_logger(const string& module, int level) {
+  logptr_t  instance;
   size_t dotpos = 0;               // position of '.' character in name
   unsigned int exit_loop = 0;      // to avoid excesive number of sub modules
 
@@ -184,9 +573,14 @@ logptr_t Logger::get_logger(const string& module, int level, int stream) {
 
     instance->debug("looking for module %s in dict", submod.c_str());
 
-    if (instance->dict.count(submod) > 0) {
-      // (sub) module exists. Fetch its pointer in the dictionary
-      instance = instance->dict[submod].lock();   // weak pointer -> shared
+    // (sub) module may exist. Fetch its pointer in the dictionary
+    // It is null if the logger is being destroyed: replace it
+    logptr_t child_instance;
+    if (instance->dict.count(submod) > 0)
+      child_instance = instance->dict[submod].lock();   // weak -> shared
+
+    if (child_instance) {
+      instance = child_instance;
       instance->debug("found existing logging instance for module %s",
                        submod.c_str());
     }
@@ -199,14 +593,23 @@ logptr_t Logger::get_logger(const string& module, int level, int stream) {
 
       instance->dict[submod] = new_instance;   // store as weak pointer
       new_instance->parent = instance;         // upwards pointer
+      // no output configured yet. Inherit the sinks, effective level and
+      // whether some sink along the chain wants JSON
+      {
+        Snapshot<route_list_t>::Reader inherited(instance->routes);
+        new_instance->routes.update([&](route_list_t& own) {
+          own = *inherited;
+        });
+        bool json = false;
+        for (auto& route : *inherited)
+          json = json or route.sink->get_format() == SINK_JSON;
+        new_instance->jsonchain = json;
+      }
+      new_instance->efflevel  = instance->efflevel.load();
+      new_instance->gatelevel = instance->gatelevel.load();
       instance = new_instance;                 // instance refcount++
     }
 
-    if (pos == string::npos) {                   // end of string reached
-      instance->set_loglevel(level);
-      instance->set_streamer(stream);
-    }
-
     if (pos == string::npos)                     // end of string reached
       break;
 
@@ -219,11 +622,103 @@ logptr_t Logger::get_logger(const string& module, int level, int stream) {
   return instance;
 }
 // set the root_debug mode
+// Only invoked on loggers that have no children (the root being created or
+// a logger being destroyed), so there are no descendants to update
 //
 void Logger::set_root_debug() {
 
-  set_loglevel(DEBUG);
-  set_streamer(STDLOG);
+  {
+    lock_guard<mutex> lock(logmutex);
+    loglevel   = DEBUG;
+    outstream  = &clog;
+    streamsink = stream_sink(STDLOG);
+  }
+  update_routes(route_list_t());
+}
+// Recompute the sinks and effective level of this logger and its
+// descendants
+// The sinks are those of every logger along the propagation chain, each
+// with the level of its logger, so that emitting a record takes no logger
+// lock. The effective level is the lowest of these levels, so that log
+// calls below it can return without formatting anything
+// Must be called without holding 'logmutex' or 'treemutex'
+//
+static mutex levelmutex;      // serializes effective level updates
+
+void Logger::update_levels() {
+  route_list_t inherited;
+
+  lock_guard<mutex> lock(levelmutex);
+  if (parent) {
+    Snapshot<route_list_t>::Reader parent_routes(parent->routes);
+    inherited = *parent_routes;
+  }
+  update_chain(inherited);
+}
+// Sink and effective level propagation down the tree (levelmutex held)
+void Logger::update_chain(const route_list_t& inherited) {
+  vector<logptr_t> children;
+  route_list_t chain = update_routes(inherited);
+
+  {
+    lock_guard<mutex> tlock(treemutex);
+    for (auto& entry : dict) {
+      logptr_t child = entry.second.lock();
+      if (child)
+        children.push_back(child);
+    }
+  }
+  for (auto& child : children)
+    child->update_chain(chain);
+}
+// Sinks and effective level of this logger alone. Returns the sinks
+Logger::route_list_t Logger::update_routes(const route_list_t& inherited) {
+  route_list_t chain;
+  int  level = NOLOG;
+  bool json  = false;
+
+  {
+    lock_guard<mutex> llock(logmutex);
+    if (streamsink)
+      chain.push_back({ loglevel, streamsink });
+    if (logfile)
+      chain.push_back({ loglevel, logfile });
+    if (mcastsink)
+      chain.push_back({ loglevel, mcastsink });
+    if (propagate)
+      chain.insert(chain.end(), inherited.begin(), inherited.end());
+  }
+  for (auto& route : chain) {
+    level = min(level, route.level);
+    json  = json or route.sink->get_format() == SINK_JSON;
+  }
+
+  // set before looking at children. A child created from now on inherits
+  // the new values. Replaced sinks are released (and flushed) here, once
+  // no record is being written to them
+  routes.update([&](route_list_t& current) {
+    current = chain;
+  });
+  efflevel  = level;
+  gatelevel = gate_for(level);
+  jsonchain = json;
+
+  return chain;
+}
+// Calls looked at by a logger: those written, or all of them when
+// filtered calls are counted or recorded
+int Logger::gate_for(int efflevel) {
+
+  return filtered_counting or flight_active() ? MINLOG : efflevel;
+}
+// Recompute the gates of all loggers once the above changed
+void Logger::update_gates() {
+  vector<logptr_t> loggers;
+
+  lock_guard<mutex> lock(levelmutex);
+  get_logger()->collect_tree(nullptr, &loggers);
+  for (auto& instance : loggers)
+    instance->gatelevel = gate_for(instance->efflevel);
 }
 // get/set current log level (safe)
 //
@@ -235,103 +730,506 @@ int Logger::get_loglevel() {
 }
 int Logger::set_loglevel(int level) {
   // set log level to new level and return current level
-
-  lock_guard<mutex> lock(logmutex);
-  int curlevel = loglevel;
-  if (level != UNCHANGED and level != ROOT_DEBUG)
-    loglevel = min(MAXLOG, max(MINLOG, abs(level)));
+  int curlevel;
+
+  {
+    lock_guard<mutex> lock(logmutex);
+    curlevel = loglevel;
+    if (level != UNCHANGED and level != ROOT_DEBUG)
+      loglevel = min(MAXLOG, max(MINLOG, abs(level)));
+    if (loglevel == curlevel)
+      return curlevel;
+  }
+  update_levels();
 
   return curlevel;
 }
 // set propagation mode for a logger (safe)
 bool Logger::set_propagation(bool mode) {
-
-  lock_guard<mutex> lock(logmutex);
-  bool curmode = propagate;
-  propagate = mode;
+  bool curmode;
+
+  {
+    lock_guard<mutex> lock(logmutex);
+    curmode = propagate;
+    propagate = mode;
+    if (propagate == curmode)
+      return curmode;
+  }
+  update_levels();
 
   return curmode;
 }
 // Configure the log file for a logger (safe)
 void Logger::set_logfile(const string& fname) {
   string newfname;
-  char*  errmsg = nullptr;
+  char*  errmsg  = nullptr;
+  bool   changed = false;
 
   // If file is provided and is different from current file, open it and
   // close existing file
   // Use absolute pathnames for file name comparison
 
-  lock_guard<mutex> lock(logmutex);
-  if (not fname.empty()) {
-    char*    p;
-
-    // Convert file path name to absolute
-    p = realpath(fname.c_str(), nullptr);
-    if (p) {
-      newfname = string(p);
-      free(p);
-    }
-    else {
-      ofstream ofs;
-
-      // Log file does not exist. Try to create it
-      ofs.open(fname, ios::trunc); 
-      if (ofs.is_open()) {
-        ofs.close();
-        // Try to build the path name again
-        p = realpath(fname.c_str(), nullptr);
+  {
+    lock_guard<mutex> lock(logmutex);
+    if (not fname.empty()) {
+      char*    p;
+
+      // Convert file path name to absolute
+      p = realpath(fname.c_str(), nullptr);
+      if (p) {
         newfname = string(p);
         free(p);
       }
-      else
-        errmsg = strerror(errno);
+      else {
+        ofstream ofs;
+
+        // Log file does not exist. Try to create it
+        ofs.open(fname, ios::trunc); 
+        if (ofs.is_open()) {
+          ofs.close();
+          // Try to build the path name again
+          p = realpath(fname.c_str(), nullptr);
+          newfname = string(p);
+          free(p);
+        }
+        else
+          errmsg = strerror(errno);
+      }
+    }
+
+    if (newfname != filename) {
+      // close current log file. Pending records get written
+      logfile.reset();
+      filename = string();
+      changed  = true;
+
+      if (not newfname.empty()) {
+        // open new log file
+        logfile = FdSink::open_file(newfname, flush_level);
+        if (logfile) {
+          logfile->set_batching(batch_bytes, batch_msecs, flush_level);
+          logfile->set_rotation(rotate_bytes, rotate_secs, rotate_keep);
+          logfile->set_format(record_format);
+          filename = newfname;
+        }
+        else
+          errmsg = strerror(errno);
+      }
     }
   }
 
-  if (newfname != filename) {
-    // close current log file
-    if (logfile.is_open())
-      logfile.close();
-    filename = string();
+  if (changed)
+    update_levels();
 
-    if (not newfname.empty()) {
-      // open new log file
-      logfile.open(newfname, ios::app);
-      if (logfile.is_open())
-        filename = newfname;
-      else
-        errmsg = strerror(errno);
+  if (errmsg)
+    error("error opening log file '%s': %s",  fname.c_str(), errmsg);
+}
+// configure log shipping (safe). The current setting is kept on error
+bool Logger::set_multicast(const string& group, unsigned short port,
+                           const string& ifname, int ttl) {
+  shared_ptr<McastSink> sink;
+  int level;
+
+  {
+    lock_guard<mutex> lock(logmutex);
+    level = flush_level;
+  }
+
+  // resolved outside our lock, as the address classes log too
+  if (not group.empty()) {
+    sink = McastSink::open(group, port, ifname, ttl, level);
+    if (not sink) {
+      error("error shipping logs to %s port %u: %s", group, port,
+            strerror(errno));
+      return false;
     }
   }
 
-  if (errmsg) {
-    logmutex.unlock();
-    error("error opening log file '%s': %s",  fname.c_str(), errmsg);
+  {
+    lock_guard<mutex> lock(logmutex);
+    mcastsink = sink;
+    if (mcastsink)
+      mcastsink->set_format(record_format);
   }
+  update_levels();
+
+  return true;
 }
-// select an output stream (safe)
-ostream* Logger::set_streamer(int streamval) {
+mcast_stats_t Logger::get_multicast_stats() {
+  mcast_stats_t stats = { 0, 0, 0, 0 };
 
   lock_guard<mutex> lock(logmutex);
-  ostream* curos = outstream;
-  switch(streamval) {
-    case STDOUT:     outstream = &cout;
-                     break;
-    case STDERR:     outstream = &cerr;
-                     break;
-    case STDLOG:     outstream = &clog;
-                     break;
-    case DEVNULL:    outstream = nullptr;
-                     break;
-    case UNCHANGED:
-    case ROOT_DEBUG:
-    default:         outstream = curos;
-                     break;
+  if (mcastsink)
+    stats = mcastsink->get_stats();
+
+  return stats;
+}
+// full path of the log file, empty if none (safe)
+string Logger::get_logfile() {
+
+  lock_guard<mutex> lock(logmutex);
+  return filename;
+}
+// configure log file batching (safe)
+void Logger::set_batching(size_t bytes, unsigned int msecs, int level) {
+
+  lock_guard<mutex> lock(logmutex);
+  batch_bytes = bytes;
+  batch_msecs = msecs;
+  flush_level = level;
+  if (logfile)
+    logfile->set_batching(bytes, msecs, level);
+}
+// configure log file rotation (safe)
+void Logger::set_rotation(unsigned long long bytes, unsigned int secs,
+                          unsigned int keep) {
+
+  lock_guard<mutex> lock(logmutex);
+  rotate_bytes = bytes;
+  rotate_secs  = secs;
+  rotate_keep  = keep;
+  if (logfile)
+    logfile->set_rotation(bytes, secs, keep);
+}
+void Logger::set_stream_batching(int streamval, size_t bytes,
+                                 unsigned int msecs, int level) {
+  shared_ptr<FdSink> sink = stream_sink(streamval);
+
+  if (sink)
+    sink->set_batching(bytes, msecs, level);
+}
+// configure the record format of the log file and shipping (safe)
+void Logger::set_format(int format) {
+
+  {
+    lock_guard<mutex> lock(logmutex);
+    record_format = format;
+    if (logfile)
+      logfile->set_format(format);
+    if (mcastsink)
+      mcastsink->set_format(format);
+  }
+  update_levels();
+}
+void Logger::set_stream_format(int streamval, int format) {
+  shared_ptr<FdSink> sink = stream_sink(streamval);
+
+  if (not sink)
+    return;
+  sink->set_format(format);
+
+  // any logger may write to the stream
+  logptr_t root = get_logger();
+  root->update_levels();
+}
+// extra fields of JSON records (safe). Kept preformatted for writers
+void Logger::set_field(const string& key, const string& value) {
+  string text;
+
+  lock_guard<mutex> lock(logmutex);
+  if (value.empty())
+    fields.erase(key);
+  else
+    fields[key] = value;
+
+  for (auto& field : fields) {
+    size_t klen = field.first.size();
+    size_t vlen = field.second.size();
+    size_t pos  = text.size();
+    // escaped text is at most 6 times as long
+    text.resize(pos + 6 * (klen + vlen) + 6);
+    char* p = &text[pos];
+    *p++ = ',';
+    *p++ = '"';
+    p += log_json_escape(p, 6 * klen + 1, field.first.data(), klen);
+    *p++ = '"';
+    *p++ = ':';
+    *p++ = '"';
+    p += log_json_escape(p, 6 * vlen + 1, field.second.data(), vlen);
+    *p++ = '"';
+    text.resize(p - &text[0]);
+  }
+
+  jsonfields.update([&](string& current) {
+    current = text;
+  });
+}
+// write pending records along the propagation chain (safe)
+void Logger::flush() {
+  Snapshot<route_list_t>::Reader chain(routes);
+
+  for (auto& route : *chain)
+    route.sink->flush();
+}
+// Find an existing logger by its full module name (safe)
+logptr_t Logger::lookup_logger(const string& module) {
+  logptr_t instance = get_logger();
+  size_t   dotpos   = 0;
+
+  if (module == "root")
+    return instance;
+
+  while (instance) {
+    size_t pos    = module.find('.', dotpos);
+    string submod = module.substr(0, pos);
+
+    lock_guard<mutex> lock(instance->treemutex);
+    auto child = instance->dict.find(submod);
+    if (child == instance->dict.end())
+      return nullptr;
+    instance = child->second.lock();
+
+    if (pos == string::npos)
+      break;
+    dotpos = pos + 1;
+  }
+
+  return instance;
+}
+// All loggers, parents first (safe)
+vector<logger_info_t> Logger::get_logger_tree() {
+  vector<logger_info_t> tree;
+
+  get_logger()->collect_tree(&tree, nullptr);
+
+  return tree;
+}
+void Logger::collect_tree(vector<logger_info_t>* tree,
+                          vector<logptr_t>* loggers) {
+  vector<logptr_t> children;
+
+  if (tree) {
+    logger_info_t info;
+    lock_guard<mutex> lock(logmutex);
+    info.module    = parent ? modname : "root";
+    info.level     = loglevel;
+    info.efflevel  = efflevel;
+    info.propagate = propagate;
+    info.stream    = outstream == &cout ? STDOUT :
+                     outstream == &cerr ? STDERR :
+                     outstream == &clog ? STDLOG : DEVNULL;
+    info.logfile   = filename;
+    tree->push_back(info);
+  }
+  if (loggers)
+    loggers->push_back(shared_from_this());
+
+  // children are visited without holding our tree lock
+  {
+    lock_guard<mutex> lock(treemutex);
+    for (auto& child : dict) {
+      logptr_t instance = child.second.lock();
+      if (instance)
+        children.push_back(instance);
+    }
+  }
+  for (auto& child : children)
+    child->collect_tree(tree, loggers);
+}
+// Counters of all loggers (safe)
+vector<logger_stats_t> Logger::get_logger_stats() {
+  vector<logptr_t>       loggers;
+  vector<logger_stats_t> stats;
+
+  get_logger()->collect_tree(nullptr, &loggers);
+  for (auto& instance : loggers)
+    stats.push_back({ instance->parent ? instance->modname : "root",
+                      instance->counters.get() });
+
+  return stats;
+}
+// Write pending records of all loggers (safe)
+void Logger::flush_all() {
+  vector<logptr_t> loggers;
+
+  get_logger()->collect_tree(nullptr, &loggers);
+  for (auto& instance : loggers)
+    instance->flush();
+}
+// runtime control (safe)
+bool Logger::start_control(const string& path) {
+
+  return control_start(path);
+}
+void Logger::stop_control() {
+
+  control_stop();
+}
+// select an output stream (safe)
+ostream* Logger::set_streamer(int streamval) {
+  ostream* curos;
+
+  {
+    lock_guard<mutex> lock(logmutex);
+    curos = outstream;
+    switch(streamval) {
+      case STDOUT:     outstream = &cout;
+                       break;
+      case STDERR:     outstream = &cerr;
+                       break;
+      case STDLOG:     outstream = &clog;
+                       break;
+      case DEVNULL:    outstream = nullptr;
+                       break;
+      case UNCHANGED:
+      case ROOT_DEBUG:
+      default:         outstream = curos;
+                       break;
+    }
+    if (outstream == curos)
+      return curos;
+    streamsink = stream_sink(streamval);
   }
+  update_levels();
 
   return curos;
 }
-string Logger::level_to_string(int level) {
+// set the number of sub-second digits in timestamps (safe)
+int Logger::set_time_precision(int precision) {
+
+  if (precision < TS_SECONDS or precision > TS_NANOSECONDS)
+    return time_precision;
+
+  return time_precision.exchange(precision);
+}
+int Logger::get_time_precision() {
+
+  return time_precision.load(memory_order_relaxed);
+}
+// filtered call counting (safe)
+atomic<bool> Logger::filtered_counting(false);
+
+void Logger::set_filtered_counting(bool mode) {
+
+  filtered_counting = mode;
+  update_gates();
+}
+bool Logger::get_filtered_counting() {
+
+  return filtered_counting;
+}
+// Format a timestamp using the per thread cache. Returns its length
+size_t Logger::format_timestamp(char* buf, size_t size, const char* timefmt,
+                                const struct timespec& ts, int precision) {
+  TimeCache& tc = timecache;
+
+  if (ts.tv_sec != tc.sec or timefmt != tc.timefmt) {
+    struct tm timeinfo;
+
+    localtime_r(&ts.tv_sec, &timeinfo);
+    tc.len     = strftime(tc.text, sizeof(tc.text), timefmt, &timeinfo);
+    tc.sec     = ts.tv_sec;
+    tc.timefmt = timefmt;
+  }
+
+  size_t len = tc.len + (precision > 0 ? precision + 1 : 0);
+  if (len >= size)
+    len = 0;
+  else {
+    memcpy(buf, tc.text, tc.len);
+    if (precision > 0) {
+      // keep the 'precision' most significant digits of the nanoseconds
+      long frac = ts.tv_nsec;
+      for (int i=precision; i<TS_NANOSECONDS; i++)
+        frac /= 10;
+      buf[tc.len] = '.';
+      for (size_t i=len-1; i>tc.len; i--) {
+        buf[i] = '0' + frac % 10;
+        frac /= 10;
+      }
+    }
+  }
+  buf[len] = '\0';
+
+  return len;
+}
+// binary logging control (safe)
+bool Logger::open_binlog(const string& fname, size_t size) {
+
+  return binlog_open(fname, size);
+}
+void Logger::close_binlog() {
+
+  binlog_close();
+}
+// module number in binary logs
+uint32_t Logger::binlog_module() {
+  uint32_t id = binmodule.load(memory_order_acquire);
+
+  if (id == 0)
+    id = binlog_module_id(binmodule,
+                          modname.substr(0, min(modname.size(),
+                                                (size_t) max_modlen)));
+  return id;
+}
+// timestamp and origin of a binary record
+void Logger::fill_entry(binlog_entry_t* entry, int level, uint32_t id) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  entry->level     = level;
+  entry->precision = time_precision.load(memory_order_relaxed);
+  entry->id        = id;
+  entry->module    = binmodule.load(memory_order_relaxed);
+  entry->thread    = get_thread_tag();
+  entry->nsec      = now.tv_nsec;
+  entry->sec       = now.tv_sec;
+}
+// flight recorder control (safe)
+bool Logger::start_flight_recorder(size_t records, const string& crash_file) {
+
+  bool started = flight_start(records, crash_file);
+  update_gates();
+  return started;
+}
+void Logger::stop_flight_recorder() {
+
+  flight_stop();
+  update_gates();
+}
+bool Logger::dump_flight_recorder(const string& fname) {
+
+  return flight_dump(fname.c_str());
+}
+// Record a formatted message in the flight recorder, cut to fit a slot
+void Logger::flight_text(int level, const char* message, size_t len) {
+  static atomic<uint32_t> fid(0);
+  FlightRecorder* recorder = flight_active();
+  uint64_t seq;
+
+  if (not recorder)
+    return;
+
+  uint32_t id = fid.load(memory_order_acquire);
+  if (id == 0)
+    id = binlog_format_id(fid, "%s");
+  binlog_module();
+
+  uint32_t slen = min(len, FLIGHT_SLOT_SIZE - sizeof(binlog_entry_t) - 4);
+  binlog_entry_t* entry = recorder->reserve(sizeof(binlog_entry_t) + 4 + slen,
+                                            seq);
+  if (entry) {
+    fill_entry(entry, level, id);
+    memcpy(entry + 1, &slen, 4);
+    memcpy((char*) (entry + 1) + 4, message, slen);
+    recorder->commit(seq);
+  }
+}
+// asynchronous mode control (safe)
+bool Logger::start_async(size_t qsize, int policy) {
+
+  return async_writer().start(qsize, policy);
+}
+void Logger::stop_async() {
+
+  async_writer().stop();
+}
+async_stats_t Logger::get_async_stats() {
+
+  return async_writer().stats();
+}
+const char* Logger::level_to_string(int level) {
   switch (level) {
     case NOTSET:   return "unset";
     case DEBUG:    return "debug";
@@ -342,133 +1240,409 @@ string Logger::level_to_string(int level) {
     default:       return "unknown";
   }
 }
-void Logger::critical(const char* format, ...) {
-  va_list vl;
-
-  va_start(vl, format);
-  Logger::logaux(CRITICAL, format, vl);
-  va_end(vl);
-} 
-void Logger::error(const char* format, ...) {
-  va_list vl;
+int Logger::string_to_level(const string& name) {
 
-  va_start(vl, format);
-  Logger::logaux(ERROR, format, vl);
-  va_end(vl);
-} 
-void Logger::warning(const char* format, ...) {
-  va_list vl;
+  if (name.size() == 1 and name[0] >= '0' + MINLOG and name[0] <= '0' + MAXLOG)
+    return name[0] - '0';
+  for (int level=MINLOG; level<=MAXLOG; level++)
+    if (name == level_to_string(level))
+      return level;
+  if (name == "notset")
+    return NOTSET;
 
-  va_start(vl, format);
-  Logger::logaux(WARNING, format, vl);
-  va_end(vl);
-} 
-void Logger::info(const char* format, ...) {
-  va_list vl;
+  return -1;
+}
+// Make room for 'len' bytes in the per thread record buffer
+static char* record_space(size_t len) {
+
+  if (recbuf.size < len) {
+    size_t size = max(len, 2 * recbuf.size);
+    char*  data = (char*) realloc(recbuf.data, size);
+    if (not data)
+      throw bad_alloc();
+    recbuf.data = data;
+    recbuf.size = size;
+    (void) &recbuf_guard;         // release the buffer at thread exit
+  }
 
-  va_start(vl, format);
-  Logger::logaux(INFO, format, vl);
-  va_end(vl);
-} 
-void Logger::debug(const char* format, ...) {
-  va_list vl;
+  return recbuf.data;
+}
+// Formats a message right after the record header at 'offset'. Nothing
+// gets truncated: the buffer grows to fit the message. Returns record length
+static size_t logmessage(size_t offset, const char* format,
+                         const log_value_t* values, size_t count) {
+  size_t len;
+
+  len = log_format(recbuf.data + offset, recbuf.size - offset,
+                   format, values, count);
+  if (len >= recbuf.size - offset) {
+    record_space(offset + len + 1);
+    len = log_format(recbuf.data + offset, recbuf.size - offset,
+                     format, values, count);
+  }
 
-  va_start(vl, format);
-  Logger::logaux(DEBUG, format, vl);
-  va_end(vl);
-} 
-void Logger::log(int level, const char* format, ...) {
-  va_list vl;
+  return offset + len;
+}
+// Formats a record header: "timestamp module: (thread) [level] "
+// Also used by offline tools to reproduce text records. 'size' must be at
+// least LOG_HEADER_SIZE. Returns header length
+size_t Logger::format_header(char* buf, size_t size, const char* timefmt,
+                             const struct timespec& ts, int precision,
+                             const char* module, size_t modlen,
+                             const char* tag, size_t taglen, int level) {
+  char   timestamp[64];
+  size_t tslen, levlen, len;
+
+  if (size < LOG_HEADER_SIZE)
+    return 0;
+
+  tslen = format_timestamp(timestamp, sizeof(timestamp), timefmt,
+                           ts, precision);
+
+  modlen = min(modlen, (size_t) ROOT_DEBUG_MODULE_NAME_SIZE);
+
+  taglen = min(taglen, (size_t) THREAD_TAG_SIZE);
+
+  const char* levstr = level_to_string(level);
+  levlen = strlen(levstr);
+
+  len = tslen + 1 + modlen + (modlen ? 2 : 0) + taglen + levlen + 3;
+
+  char* p = buf;
+  memcpy(p, timestamp, tslen);
+  p += tslen;
+  *p++ = ' ';
+  memcpy(p, module, modlen);
+  p += modlen;
+  if (modlen) {
+    *p++ = ':';
+    *p++ = ' ';
+  }
+  memcpy(p, tag, taglen);
+  p += taglen;
+  *p++ = '[';
+  memcpy(p, levstr, levlen);
+  p += levlen;
+  *p++ = ']';
+  *p++ = ' ';
+
+  return len;
+}
+// Record tag of the calling thread
+static ThreadTag& thread_tag() {
+  ThreadTag& t = threadtag;
+
+  if (not t.known) {
+    t.tid   = (unsigned int) syscall(SYS_gettid);
+    t.tag   = this_thread::get_id() == main_thread_id ? 0 : t.tid;
+    t.len   = Logger::format_thread_tag(t.text, sizeof(t.text), t.tag, t.name);
+    t.known = true;
+  }
 
-  va_start(vl, format);
-  Logger::logaux(level, format, vl);
-  va_end(vl);
+  return t;
 }
+// "(name:tid) ". Returns its length
+size_t Logger::format_thread_tag(char* buf, size_t size,
+                                 unsigned int thread, const char* name) {
+  int len;
 
-// Logs a message with a given log level
-string& Logger::logmessage(string& message,
-                                const char* format, va_list vl) {
-  char msg[256];
+  if (size == 0)
+    return 0;
 
-  // Create log message
-  // note that long messages get truncated to 256 characters
-  if (vsnprintf(msg, sizeof(msg), format, vl) < 0)
-    snprintf(msg, sizeof(msg), "logging error: %s", strerror(errno));
+  if (thread == 0) {
+    buf[0] = '\0';
+    len    = 0;
+  }
+  else if (name and name[0])
+    len = snprintf(buf, size, "(%s:%u) ", name, thread);
+  else
+    len = snprintf(buf, size, "(%u) ", thread);
 
-  message = string(msg);
+  return min((size_t) max(len, 0), size - 1);
+}
+// Tag identifying the calling thread in records
+unsigned int Logger::get_thread_tag() {
+
+  return thread_tag().tag;
+}
+// A named main thread is tagged with its thread id, like the others
+void Logger::set_thread_name(const string& name) {
+  ThreadTag& t = thread_tag();
+
+  snprintf(t.name, sizeof(t.name), "%s", name.c_str());
+  t.tag = this_thread::get_id() == main_thread_id and not t.name[0] ? 0 :
+                                                                      t.tid;
+  t.len = format_thread_tag(t.text, sizeof(t.text), t.tag, t.name);
 
-  return message; 
+  if (t.tag)
+    binlog_thread_name(t.tag, t.name);
 }
+string Logger::get_thread_name() {
 
-string& Logger::logrecord(string& record, const char* timefmt,
-                          string modname, string& message, int level) {
+  return thread_tag().name;
+}
+// Formats the record header at 'offset' in the record buffer and returns
+// its timestamp in 'now'
+// Leaves room for a typical message. Returns header length
+size_t Logger::logrecord(size_t offset, const char* timefmt, int level,
+                         struct timespec& now) {
 
   // Get current timestamp
-  char timestamp[32];
-  time_t now = time(0);
-  tm* timeinfo = localtime(&now);
-  strftime(timestamp, sizeof(timestamp), timefmt, timeinfo);
-
-  if (modname.size() > max_modlen)
-    modname = modname.substr(0, max_modlen);
-
-  string msep;
-  if (modname.size() > 0)
-    msep = ": ";
-
-  char tids[64];
-  tids[0] = '\0';
-  thread::id tid = this_thread::get_id();
-  if (tid != main_thread_id)
-    snprintf(tids, sizeof(tids), "(%x) ",
-             (unsigned int) hash<thread::id>()(this_thread::get_id()));
-
-  // the final record formatting
-  char entry[256];
-  if (snprintf(entry, sizeof(entry), "%s %s%s%s[%s] %s",
-        timestamp, modname.c_str(), msep.c_str(), tids,
-        level_to_string(level).c_str(), message.c_str()) < 0)
-    snprintf(entry, sizeof(entry), "logging error: %s", strerror(errno));
-    
-  record = string(entry);
+  clock_gettime(CLOCK_REALTIME, &now);
 
-  return record;
+  char* p = record_space(offset + LOG_HEADER_SIZE + LOG_RECORD_SIZE) + offset;
+  ThreadTag& tag = thread_tag();
+
+  return format_header(p, LOG_HEADER_SIZE, timefmt, now,
+                       time_precision.load(memory_order_relaxed),
+                       modname.data(), min(modname.size(), (size_t) max_modlen),
+                       tag.text, tag.len, level);
 }  
-void Logger::logaux(int level, const char* format, va_list vl) {
+// Formats the JSON form of a record at 'offset' in the record buffer. The
+// message is the text from 'msgoff' up to 'offset'. Returns its length
+size_t Logger::logjson(size_t offset, const struct timespec& now, int level,
+                       size_t msgoff, const log_value_t* values,
+                       size_t count) {
+  Snapshot<string>::Reader extra(jsonfields);
+  ThreadTag& tag = thread_tag();
+  log_json_t record;
+
+  record.ts          = now;
+  record.precision   = time_precision.load(memory_order_relaxed);
+  record.module      = modname.data();
+  record.modlen      = modname.size();
+  record.thread      = tag.tid;
+  record.thread_name = tag.name;
+  record.level       = level_to_string(level);
+  record.msglen      = offset - msgoff;
+  record.values      = values;
+  record.count       = count;
+  record.fields      = extra->data();
+  record.fieldslen   = extra->size();
+
+  record.message = recbuf.data + msgoff;
+  size_t len = log_json_record(recbuf.data + offset, recbuf.size - offset,
+                               record);
+  if (len >= recbuf.size - offset) {
+    record_space(offset + len + 1);
+    record.message = recbuf.data + msgoff;
+    len = log_json_record(recbuf.data + offset, recbuf.size - offset, record);
+  }
+
+  return len;
+}
+void Logger::logvalues(int level, const char* format,
+                       const log_value_t* values, size_t count) {
   const char* timefmt = TIMEFMT;
-  string  msg, rec;
-  string& message = msg;
-  string& record  = rec;
-  Logger* instance;
+  struct timespec now;
+  size_t len, jlen = 0;
 
   // retain original 'level' and 'modname' values across potential loggers
-  // Message formatting
-  message = logmessage(message, format, vl);
-  // Record formatting as a log message wrapper
-  record  = logrecord(record, timefmt, modname, message, level);
+  // Record header and message are formatted in the per thread buffer
+  size_t hlen = logrecord(0, timefmt, level, now);
+  len = logmessage(hlen, format, values, count);
+
+  flight_text(level, recbuf.data + hlen, len - hlen);
+  if (not enabled(level))
+    return;
+  if (repeat_msecs.load(memory_order_relaxed) and
+      suppressed(level, recbuf.data + hlen, len - hlen))
+    return;
+
+  // the JSON form follows the text form
+  if (jsonchain.load(memory_order_relaxed))
+    jlen = logjson(len, now, level, hlen, values, count);
+
+  // in asynchronous mode the writer thread does the rest
+  if (not dying and async_writer().push(this, level, recbuf.data, len, jlen))
+    return;
+
+  emit(level, recbuf.data, len, recbuf.data + len, jlen);
+}
+// Record the raw values of a direct call in the flight recorder, as
+// logflight() does. The message is formatted instead if the values do not
+// fit the format or a slot
+void Logger::flight_values(int level, const char* format,
+                           const log_value_t* values, size_t count) {
+  FlightRecorder* recorder = flight_active();
+  uint64_t seq;
+
+  if (not recorder)
+    return;
+
+  size_t   len = sizeof(binlog_entry_t) + binlog_values_size(values, count);
+  uint32_t id  = binlog_values_format_id(format, values, count);
+  if (id == 0 or len > FLIGHT_SLOT_SIZE) {
+    size_t mlen = logmessage(0, format, values, count);
+    flight_text(level, recbuf.data, mlen);
+    return;
+  }
+  binlog_module();
 
-  instance = this;
-  while (instance) {
+  binlog_entry_t* entry = recorder->reserve(len, seq);
+  if (entry) {
+    fill_entry(entry, level, id);
+    binlog_put_values((char*) (entry + 1), values, count);
+    recorder->commit(seq);
+  }
+}
+// Write a formatted record to the streams and files of this logger and
+// its ancestors
+// No logger is locked: the sinks along the chain are precomputed, and each
+// sink serializes its own writes
+// JSON sinks get the JSON form if there is one (the sink may have switched
+// formats after the record was formatted)
+void Logger::emit(int level, const char* record, size_t len,
+                  const char* json, size_t jlen) {
+  Snapshot<route_list_t>::Reader chain(routes);
+  long long start = mono_nsecs();
+  size_t    bytes = 0;
+
+  for (auto& route : *chain) {
+    if (level < route.level)
+      continue;
+    if (jlen and route.sink->get_format() == SINK_JSON) {
+      route.sink->write(json, jlen, level);
+      bytes += jlen + 1;
+    }
+    else {
+      route.sink->write(record, len, level);
+      bytes += len + 1;
+    }
+  }
 
-    // lock here to prevent other threads from changing level, stream, etc
-    lock_guard<mutex> lock(instance->logmutex);
+  counters.count_emitted(level, bytes, mono_nsecs() - start);
+}
 
-    if (level >= instance->loglevel) {
-      // log to stream if configured
-      if (instance->outstream) {
-        *instance->outstream << record << endl;
-      }
+//////////// Repeated message suppression
+//
+// One 64 bit hash of the last message written per logger. Threads logging
+// the same message at once may let an extra copy through or count a repeat
+// twice; nothing else is shared
+//
+static uint64_t message_hash(const char* message, size_t len, int level) {
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ (len << 8) ^ level;
+  uint64_t word;
+
+  for (; len >= 8; message += 8, len -= 8) {
+    memcpy(&word, message, 8);
+    h = (h ^ word) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+  }
+  for (; len > 0; message++, len--)
+    h = (h ^ (unsigned char) *message) * 0x100000001b3ULL;
 
-      // log to log file if open
-      if (instance->logfile.is_open()) {
-        instance->logfile << record << endl;
-        instance->logfile.flush();
-      }
+  return h ^ (h >> 29);
+}
+
+///////////// Repeated message suppression
+//
+// The last message of a logger, its level, when it was first written and
+// the repeats since are updated together under 'repeatmutex', so that a
+// count is always reported against the message it belongs to
+//
+// Repeats followed by nothing are reported by the flusher thread once
+// their window is over, through a sink registered while suppression is
+// on. Those reports are written right away, not queued: the flusher holds
+// no reference to the logger
+//
+class RepeatReporter : public LogSink {
+  private:
+    Logger* logger;
+  public:
+    explicit RepeatReporter(Logger* logger) : logger(logger) {
+      register_sink(this);
     }
+    ~RepeatReporter() {
+      unregister_sink(this);
+    }
+    void write(const char*, size_t, int) {}
+    // at exit, whatever the window
+    void flush() {
+      logger->report_repeats(LLONG_MAX);
+      logger->flush();
+    }
+    void expire(long long now) {
+      logger->report_repeats(now);
+    }
+};
+
+void Logger::set_suppression(unsigned int msecs) {
+
+  // no report from the flusher thread past this point
+  if (msecs == 0)
+    repeat_reporter.reset();
+  report_repeats(LLONG_MAX, true);
+  {
+    lock_guard<mutex> lock(repeatmutex);
+    repeat_hash  = 0;
+    repeat_msecs = msecs;
+  }
+  if (msecs and not repeat_reporter)
+    repeat_reporter.reset(new RepeatReporter(this));
+}
 
-    if (not instance->propagate)
-      break;
+void Logger::report_repeats(long long now, bool queue) {
+  unsigned long count;
+  int           level;
+
+  {
+    lock_guard<mutex> lock(repeatmutex);
+    if (repeats == 0 or now - repeat_since < repeat_msecs)
+      return;
+    count   = repeats;
+    level   = repeat_level;
+    repeats = 0;
+  }
+  log_repeated(level, count, 0, queue);
+}
 
-    instance = instance->parent.get();
+// Whether 'message' repeats the last one. Otherwise the repeats counted so
+// far are reported before it. 'message' is the end of the record buffer
+bool Logger::suppressed(int level, const char* message, size_t len) {
+  uint64_t      hash = message_hash(message, len, level);
+  long long     now  = mono_msecs();
+  unsigned long count;
+  int           last;
+
+  {
+    lock_guard<mutex> lock(repeatmutex);
+    if (hash == repeat_hash and now - repeat_since < repeat_msecs) {
+      repeats++;
+      counters.count_suppressed();
+      return true;
+    }
+    last         = repeat_level;
+    count        = repeats;
+    repeat_hash  = hash;
+    repeat_level = level;
+    repeat_since = now;
+    repeats      = 0;
   }
+  if (count)
+    log_repeated(last, count, message + len - recbuf.data);
+
+  return false;
+}
+
+// Formatted in the per thread buffer past 'offset', as the record being
+// written may be there
+void Logger::log_repeated(int level, unsigned long count, size_t offset,
+                          bool queue) {
+  struct timespec now;
+  log_value_t     value = log_value(count);
+  size_t          jlen  = 0;
+
+  size_t hlen = logrecord(offset, TIMEFMT, level, now);
+  size_t len  = logmessage(offset + hlen, "last message repeated %lu times",
+                           &value, 1);
+  if (jsonchain.load(memory_order_relaxed))
+    jlen = logjson(len, now, level, offset + hlen, &value, 1);
+
+  const char* record = recbuf.data + offset;
+  if (queue and not dying and
+      async_writer().push(this, level, record, len - offset, jlen))
+    return;
+
+  emit(level, record, len - offset, recbuf.data + len, jlen);
 }
@@ -0,0 +1,283 @@
+/*
+A multicast interface to the socket library
+
+  Log shipping to a multicast group
+
+    A sink packing records into datagrams sent to a multicast group. See
+    logmcast.h. 'logcollect' receives them
+
+*/
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "address.h"
+#include "getifaddrs.h"
+#include "logmcast.h"
+
+using namespace std;
+
+McastSink::McastSink(int fd, const struct sockaddr* group, socklen_t grouplen,
+                     int flush_level, unsigned int max_msecs) :
+                       fd(fd),
+                       grouplen(grouplen),
+                       flush_level(flush_level),
+                       max_msecs(max_msecs),
+                       first_pending(0),
+                       seq(0),
+                       records(0),
+                       datagrams(0),
+                       dropped(0),
+                       truncated(0)             {
+
+  memcpy(&this->group, group, min((size_t) grouplen, sizeof(this->group)));
+  current.records = 0;
+  register_sink(this);
+}
+
+McastSink::~McastSink() {
+
+  unregister_sink(this);
+  flush();
+  close(fd);
+}
+
+// Move the datagram being filled to the queue (bufmutex held)
+void McastSink::seal() {
+
+  if (current.records == 0)
+    return;
+
+  if (queue.size() >= MCAST_QUEUE_SIZE)
+    dropped += current.records;
+  else
+    queue.push_back(move(current));
+
+  current.data.clear();
+  current.records = 0;
+}
+
+// Send the queued datagrams. Without 'wait' nothing is done if another
+// thread is sending: it takes care of them
+void McastSink::send_queued(bool wait) {
+  unique_lock<mutex> iolock(iomutex, defer_lock);
+
+  if (wait)
+    iolock.lock();
+  else if (not iolock.try_lock())
+    return;
+
+  for (;;) {
+    deque<datagram_t> sending;
+    {
+      lock_guard<mutex> lock(bufmutex);
+      sending.swap(queue);
+    }
+    if (sending.empty())
+      break;
+
+    for (auto& dgram : sending) {
+      uint32_t nseq = htonl(seq++);
+      memcpy(&dgram.data[offsetof(mcast_header_t, seq)], &nseq, sizeof(nseq));
+
+      ssize_t n;
+      do
+        n = sendto(fd, dgram.data.data(), dgram.data.size(), MSG_DONTWAIT,
+                   (struct sockaddr*) &group, grouplen);
+      while (n < 0 and errno == EINTR);
+
+      if (n < 0)
+        dropped += dgram.records;
+      else {
+        datagrams++;
+        records += dgram.records;
+      }
+    }
+  }
+}
+
+void McastSink::write(const char* record, size_t len, int level) {
+  bool send;
+
+  {
+    lock_guard<mutex> lock(bufmutex);
+
+    if (sizeof(mcast_header_t) + len + 1 > MCAST_DATAGRAM_SIZE) {
+      len = MCAST_DATAGRAM_SIZE - sizeof(mcast_header_t) - 1;
+      truncated++;
+    }
+    if (current.data.size() + len + 1 > MCAST_DATAGRAM_SIZE)
+      seal();
+    if (current.records == 0) {
+      mcast_header_t header;
+      memcpy(header.magic, MCAST_MAGIC, sizeof(header.magic));
+      header.seq = 0;                      // set when sent
+      current.data.reserve(MCAST_DATAGRAM_SIZE);
+      current.data.assign((const char*) &header, sizeof(header));
+      first_pending = mono_msecs();
+    }
+    current.data.append(record, len);
+    current.data += '\n';
+    current.records++;
+
+    if (level >= flush_level)
+      seal();
+    send = not queue.empty();
+  }
+
+  if (send)
+    send_queued(false);
+}
+
+void McastSink::flush() {
+
+  {
+    lock_guard<mutex> lock(bufmutex);
+    seal();
+  }
+  send_queued(true);
+}
+
+void McastSink::expire(long long now) {
+
+  {
+    lock_guard<mutex> lock(bufmutex);
+    if (current.records > 0 and now - first_pending >= max_msecs)
+      seal();
+    if (queue.empty())
+      return;
+  }
+  send_queued(true);
+}
+
+mcast_stats_t McastSink::get_stats() const {
+  mcast_stats_t stats;
+
+  stats.records   = records;
+  stats.datagrams = datagrams;
+  stats.dropped   = dropped;
+  stats.truncated = truncated;
+
+  return stats;
+}
+
+// Outgoing interface: an IPv4 address of the interface, or its index for
+// IPv6. Returns false if the interface has none
+static bool set_interface(int fd, int family, const string& ifname,
+                          unsigned int& index) {
+  vector<NetworkInterface*> nis;
+  bool found = false;
+
+  try {
+    nis = get_network_interfaces(ifname, family);
+  }
+  catch (...) {
+    return false;
+  }
+
+  for (auto ni : nis) {
+    if (ni->name == ifname and not found) {
+      if (family == AF_INET6) {
+        index = ni->index;
+        found = setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF,
+                           &index, sizeof(index)) == 0;
+      }
+      else {
+        for (auto addr : ni->addrvec) {
+          if (addr->get_family() != AF_INET)
+            continue;
+          found = setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF,
+                             addr->get_binaddr(), sizeof(struct in_addr)) == 0;
+          break;
+        }
+      }
+    }
+    for (auto addr : ni->addrvec)
+      delete addr;
+    delete ni;
+  }
+
+  return found;
+}
+
+shared_ptr<McastSink> McastSink::open(const string& group, unsigned short port,
+                                      const string& ifname, int ttl,
+                                      int flush_level) {
+  struct sockaddr_storage ss;
+  socklen_t sslen;
+  unique_ptr<Address> addr(get_address(group));
+
+  if (not addr or not addr->is_multicast() or
+      (addr->get_family() != AF_INET and addr->get_family() != AF_INET6)) {
+    errno = EINVAL;
+    return nullptr;
+  }
+  int family = addr->get_family();
+
+  int fd = socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return nullptr;
+
+  // the zone of an IPv6 group ("ff02::1%eth0") names the interface too
+  unsigned int zone  = addr->get_value().get_scope_id();
+  unsigned int index = 0;
+  if (not ifname.empty() and not set_interface(fd, family, ifname, index)) {
+    close(fd);
+    errno = ENODEV;
+    return nullptr;
+  }
+  if (zone and ifname.empty()) {
+    index = zone;
+    if (setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF,
+                   &index, sizeof(index)) < 0) {
+      close(fd);
+      errno = ENODEV;
+      return nullptr;
+    }
+  }
+  else if (zone and zone != index) {
+    close(fd);
+    errno = EINVAL;
+    return nullptr;
+  }
+
+  memset(&ss, 0, sizeof(ss));
+  int rc;
+  if (family == AF_INET) {
+    auto sin = (struct sockaddr_in*) &ss;
+    sin->sin_family = AF_INET;
+    sin->sin_port   = htons(port);
+    memcpy(&sin->sin_addr, addr->get_binaddr(), sizeof(sin->sin_addr));
+    sslen = sizeof(*sin);
+    rc = setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+  }
+  else {
+    auto sin6 = (struct sockaddr_in6*) &ss;
+    sin6->sin6_family   = AF_INET6;
+    sin6->sin6_port     = htons(port);
+    sin6->sin6_scope_id = index;
+    memcpy(&sin6->sin6_addr, addr->get_binaddr(), sizeof(sin6->sin6_addr));
+    sslen = sizeof(*sin6);
+    rc = setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+  }
+  if (rc < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return nullptr;
+  }
+
+  return make_shared<McastSink>(fd, (struct sockaddr*) &ss, sslen,
+                                flush_level);
+}
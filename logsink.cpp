@@ -0,0 +1,313 @@
+/*
+A multicast interface to the socket library
+
+  Log record outputs (sinks)
+
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logsink.h"
+
+using namespace std;
+
+LogSink::~LogSink() {}
+
+void LogSink::expire(long long) {}
+
+///////////// Sink flusher
+//
+// A background thread writing out batches that have been pending for too
+// long. It is started with the first sink and never stopped. Its state is
+// never destroyed, as sinks may live until static destruction
+//
+class SinkFlusher {
+  private:
+    mutex            regmutex;      // registered sinks
+    vector<LogSink*> sinks;
+    bool             started;
+    //
+    void run();
+  public:
+    SinkFlusher() : started(false) {};
+    void add(LogSink* sink);
+    void remove(LogSink* sink);
+    void flush_all();
+};
+
+static SinkFlusher& sink_flusher() {
+  static SinkFlusher* instance = new SinkFlusher();
+  return *instance;
+}
+
+void flush_all_sinks() {
+
+  sink_flusher().flush_all();
+}
+
+void register_sink(LogSink* sink) {
+
+  sink_flusher().add(sink);
+}
+
+void unregister_sink(LogSink* sink) {
+
+  sink_flusher().remove(sink);
+}
+
+void SinkFlusher::add(LogSink* sink) {
+
+  lock_guard<mutex> lock(regmutex);
+  sinks.push_back(sink);
+
+  if (not started) {
+    started = true;
+    atexit(flush_all_sinks);
+    thread(&SinkFlusher::run, this).detach();
+  }
+}
+
+void SinkFlusher::remove(LogSink* sink) {
+
+  lock_guard<mutex> lock(regmutex);
+  sinks.erase(std::remove(sinks.begin(), sinks.end(), sink), sinks.end());
+}
+
+void SinkFlusher::flush_all() {
+
+  lock_guard<mutex> lock(regmutex);
+  for (auto sink : sinks)
+    sink->flush();
+}
+
+void SinkFlusher::run() {
+
+  for (;;) {
+    this_thread::sleep_for(chrono::milliseconds(SINK_FLUSH_TICK));
+
+    long long now = mono_msecs();
+    lock_guard<mutex> lock(regmutex);
+    for (auto sink : sinks)
+      sink->expire(now);
+  }
+}
+
+///////////// FdSink class
+//
+FdSink::FdSink(int fd, bool owned, int flush_level,
+               size_t max_bytes, unsigned int max_msecs) :
+                 fd(fd),
+                 owned(owned),
+                 max_bytes(max_bytes),
+                 max_msecs(max_msecs),
+                 flush_level(flush_level),
+                 first_pending(0),
+                 rotate_bytes(0),
+                 rotate_secs(0),
+                 rotate_keep(SINK_ROTATE_KEEP),
+                 opened_at(mono_msecs()),
+                 file_size(0)                 {
+
+  sink_flusher().add(this);
+}
+
+FdSink::~FdSink() {
+
+  sink_flusher().remove(this);
+  flush();
+
+  if (owned)
+    close(fd);
+}
+
+shared_ptr<FdSink> FdSink::open_file(const string& fname, int flush_level) {
+
+  int fd = open(fname.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat st;
+  shared_ptr<FdSink> sink = make_shared<FdSink>(fd, true, flush_level);
+  if (fstat(fd, &st) == 0)
+    sink->file_size = st.st_size;
+  lock_guard<mutex> lock(sink->bufmutex);  // the flusher may be looking
+  sink->path = fname;
+
+  return sink;
+}
+
+void FdSink::set_batching(size_t bytes, unsigned int msecs, int level) {
+
+  {
+    lock_guard<mutex> lock(bufmutex);
+    max_bytes   = bytes;
+    max_msecs   = msecs;
+    flush_level = level;
+  }
+  flush();
+}
+
+void FdSink::set_rotation(unsigned long long bytes, unsigned int secs,
+                          unsigned int keep) {
+
+  lock_guard<mutex> lock(bufmutex);
+  rotate_bytes = bytes;
+  rotate_secs  = secs;
+  rotate_keep  = keep;
+}
+
+void FdSink::rotate_expired(long long now) {
+
+  // callers other than the flusher thread must not shift files under it
+  lock_guard<mutex> rlock(rotatemutex);
+  {
+    lock_guard<mutex> lock(bufmutex);
+    if (path.empty() or
+        not ((rotate_bytes > 0 and file_size >= rotate_bytes) or
+             (rotate_secs > 0 and now - opened_at >= rotate_secs * 1000LL)))
+      return;
+  }
+  rotate(now);
+}
+
+// Shift name.N-1 -> name.N ... name -> name.1 and reopen name
+// Records keep going to the old descriptor (now name.1) until the switch
+void FdSink::rotate(long long now) {
+  unsigned int keep;
+
+  {
+    lock_guard<mutex> lock(bufmutex);
+    keep      = rotate_keep;
+    opened_at = now;             // on failure, do not retry every tick
+  }
+
+  for (unsigned int i = keep; i > 1; i--)
+    rename((path + '.' + to_string(i - 1)).c_str(),
+           (path + '.' + to_string(i)).c_str());
+  if (keep > 0)
+    rename(path.c_str(), (path + ".1").c_str());
+  else
+    unlink(path.c_str());
+
+  int newfd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                   0644);
+  if (newfd < 0)
+    return;
+
+  int oldfd;
+  {
+    lock_guard<mutex> iolock(iomutex);
+    oldfd = fd;
+    fd    = newfd;
+    file_size = 0;
+  }
+  close(oldfd);
+}
+
+void FdSink::write(const char* record, size_t len, int level) {
+
+  {
+    lock_guard<mutex> lock(bufmutex);
+    if (max_bytes > 0 and level < flush_level and
+        pending.size() + len + 1 < max_bytes) {
+      if (pending.empty())
+        first_pending = mono_msecs();
+      pending.append(record, len);
+      pending += '\n';
+      return;
+    }
+  }
+
+  // write pending records and this one at once
+  write_batch(record, len);
+}
+
+void FdSink::flush() {
+
+  write_batch(nullptr, 0);
+}
+
+void FdSink::expire(long long now) {
+
+  flush_expired(now);
+  rotate_expired(now);
+}
+
+void FdSink::flush_expired(long long now) {
+
+  {
+    lock_guard<mutex> lock(bufmutex);
+    if (pending.empty() or now - first_pending < max_msecs)
+      return;
+  }
+  flush();
+}
+
+// Write pending records, followed by 'record' if given, in a single writev
+void FdSink::write_batch(const char* record, size_t len) {
+  struct iovec iov[3];
+  int          iovcnt = 0;
+
+  lock_guard<mutex> iolock(iomutex);
+  {
+    lock_guard<mutex> lock(bufmutex);
+    pending.swap(writing);               // both keep their capacity
+  }
+
+  if (not writing.empty()) {
+    iov[iovcnt].iov_base = (void*) writing.data();
+    iov[iovcnt].iov_len  = writing.size();
+    iovcnt++;
+  }
+  if (record) {
+    iov[iovcnt].iov_base = (void*) record;
+    iov[iovcnt].iov_len  = len;
+    iovcnt++;
+    iov[iovcnt].iov_base = (void*) "\n";
+    iov[iovcnt].iov_len  = 1;
+    iovcnt++;
+  }
+  if (iovcnt == 0)
+    return;
+
+  // keep the order with regular program output
+  if (fd == STDOUT_FILENO)
+    fflush(stdout);
+
+  struct iovec* piov = iov;
+  while (iovcnt > 0) {
+    ssize_t n = writev(fd, piov, iovcnt);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;                              // records are lost
+    }
+    file_size += n;
+    // skip what has been written (partial writes)
+    while (iovcnt > 0 and (size_t) n >= piov->iov_len) {
+      n -= piov->iov_len;
+      piov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      piov->iov_base = (char*) piov->iov_base + n;
+      piov->iov_len -= n;
+    }
+  }
+
+  writing.clear();
+}
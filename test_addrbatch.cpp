@@ -0,0 +1,170 @@
+// Checks the bulk IPv4 conversions against inet_pton() and inet_ntop()
+// with every kernel the CPU has, over random texts and addresses. Some
+// texts end right before an unmapped page, where reading past them faults
+//
+// usage: test_addrbatch [seed]
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "addrbatch.h"
+
+using namespace std;
+
+#define TEST_TEXTS     200000
+#define TEST_ADDRS     200000
+#define GUARDED_TEXTS  64             // texts at the end of a page
+
+static const char* kernel_names[] = { "scalar", "sse4", "avx2" };
+
+// mostly near misses of dotted quads
+static string random_text(mt19937& rng) {
+  static const char chars[] = "0123456789.";
+  char   quad[INET_ADDRSTRLEN];
+  struct in_addr in;
+
+  in.s_addr = rng();
+  inet_ntop(AF_INET, &in, quad, sizeof(quad));
+  string text(quad);
+
+  switch (rng() % 8) {
+    case 0:                                    // as is
+    case 1:
+      break;
+    case 2:                                    // a character replaced
+      text[rng() % text.size()] = chars[rng() % (sizeof(chars) - 1)];
+      break;
+    case 3:                                    // one inserted
+      text.insert(rng() % (text.size() + 1), 1,
+                  "0123456789.x: "[rng() % 14]);
+      break;
+    case 4:                                    // one removed
+      text.erase(rng() % text.size(), 1);
+      break;
+    case 5:                                    // leading zeros, big parts
+      text.insert(text.find('.') + 1, rng() % 2 ? "0" : "9");
+      break;
+    default: {                                 // anything
+      text.clear();
+      for (unsigned n = rng() % 18; n > 0; n--)
+        text += chars[rng() % (sizeof(chars) - 1)];
+    }
+  }
+
+  return text;
+}
+
+// parse 'texts' with the batch and one by one. Returns mismatches
+static int check_parse(const vector<const char*>& texts) {
+  vector<struct in_addr> addrs(texts.size());
+  unique_ptr<bool[]>     valid(new bool[texts.size()]);
+  int failures = 0;
+
+  size_t n = parse_ipv4_batch(texts.data(), texts.size(), addrs.data(),
+                              valid.get());
+  size_t expected = 0;
+  for (size_t i=0; i<texts.size(); i++) {
+    struct in_addr in;
+    bool ok = inet_pton(AF_INET, texts[i], &in) == 1;
+    expected += ok;
+    if (ok != valid[i] or (ok and in.s_addr != addrs[i].s_addr)) {
+      if (failures++ < 10)
+        cout << "  parse \"" << texts[i] << "\": " << valid[i] << " "
+             << hex << ntohl(addrs[i].s_addr) << dec << ", expected "
+             << ok << endl;
+    }
+  }
+  if (n != expected)
+    failures++;
+
+  return failures;
+}
+
+static int check_format(const vector<struct in_addr>& addrs) {
+  unique_ptr<char[][INET_ADDRSTRLEN]> texts(
+    new char[addrs.size()][INET_ADDRSTRLEN]);
+  int failures = 0;
+
+  format_ipv4_batch(addrs.data(), addrs.size(), texts.get());
+  for (size_t i=0; i<addrs.size(); i++) {
+    char expected[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addrs[i], expected, sizeof(expected));
+    if (strcmp(expected, texts[i]) != 0 and failures++ < 10)
+      cout << "  format " << expected << ": \"" << texts[i] << "\"" << endl;
+  }
+
+  return failures;
+}
+
+int main(int argc, char* argv[]) {
+  unsigned seed = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1;
+  long     page = sysconf(_SC_PAGESIZE);
+  int      failures = 0;
+  mt19937  rng(seed);
+
+  // random texts, plus the edges
+  vector<string> strings = { "0.0.0.0", "255.255.255.255", "256.0.0.0",
+                             "1.2.3.4.", ".1.2.3.4", "1..2.3", "01.2.3.4",
+                             "1.2.3", "1.2.3.04", "100.200.99.10", "",
+                             "1.2.3.4 ", "1.2.3.1000", "0.0.0.00" };
+  while (strings.size() < TEST_TEXTS)
+    strings.push_back(random_text(rng));
+  vector<const char*> texts;
+  for (auto& s : strings)
+    texts.push_back(s.c_str());
+
+  // the same ones at the end of a page followed by an unmapped one
+  char* guarded = (char*) mmap(nullptr, 2 * GUARDED_TEXTS * page,
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (guarded == MAP_FAILED) {
+    cout << "cannot map guarded pages" << endl;
+    return 1;
+  }
+  vector<const char*> edge_texts;
+  for (int i=0; i<GUARDED_TEXTS; i++) {
+    char*         end = guarded + (2 * i + 1) * page;
+    const string& s   = strings[i];
+    mprotect(end, page, PROT_NONE);
+    memcpy(end - s.size() - 1, s.c_str(), s.size() + 1);
+    edge_texts.push_back(end - s.size() - 1);
+  }
+
+  // random addresses, plus every byte value at every position
+  vector<struct in_addr> addrs;
+  for (unsigned b=0; b<256; b++) {
+    struct in_addr in;
+    in.s_addr = htonl(b * 0x01010101u ^ ((255 - b) << 8));
+    addrs.push_back(in);
+  }
+  while (addrs.size() < TEST_ADDRS) {
+    struct in_addr in;
+    in.s_addr = rng();
+    addrs.push_back(in);
+  }
+
+  for (int k=BATCH_SCALAR; k<=BATCH_AVX2; k++) {
+    if (not set_batch_kernel(k)) {
+      cout << kernel_names[k] << ": not supported" << endl;
+      continue;
+    }
+    int parse  = check_parse(texts) + check_parse(edge_texts);
+    int format = check_format(addrs);
+    cout << kernel_names[k] << ": " << parse << " parse and " << format
+         << " format mismatches" << endl;
+    failures += parse + format;
+  }
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+// Checks the IPv6 text of address values against inet_ntop() over random
+// addresses rich in zero groups, and the zone of scoped ones
+//
+// usage: test_addrformat [seed]
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "address.h"
+
+using namespace std;
+
+#define TEST_ADDRS  500000
+
+// groups are zero half of the time, and of 1 to 4 digits otherwise
+static struct in6_addr random_addr(mt19937& rng) {
+  struct in6_addr in6;
+
+  for (int i=0; i<8; i++) {
+    unsigned int group = rng() % 2 ? 0 : rng() & (0xffff >> 4 * (rng() % 4));
+    in6.s6_addr[2 * i]     = group >> 8;
+    in6.s6_addr[2 * i + 1] = group & 0xff;
+  }
+  switch (rng() % 8) {
+    case 0:                                    // IPv4-mapped
+      memset(in6.s6_addr, 0, 10);
+      in6.s6_addr[10] = in6.s6_addr[11] = 0xff;
+      break;
+    case 1:                                    // IPv4-compatible
+      memset(in6.s6_addr, 0, 12);
+      break;
+  }
+
+  return in6;
+}
+
+static int check(const struct in6_addr& in6) {
+  char expected[INET6_ADDRSTRLEN];
+  char text[ADDRESS_TEXT_SIZE];
+
+  inet_ntop(AF_INET6, &in6, expected, sizeof(expected));
+  AddressValue(in6).format(text, sizeof(text));
+  if (strcmp(text, expected) == 0)
+    return 0;
+
+  cout << "  " << expected << ": \"" << text << "\"" << endl;
+  return 1;
+}
+
+int main(int argc, char* argv[]) {
+  unsigned seed = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1;
+  int      failures = 0;
+  mt19937  rng(seed);
+
+  vector<const char*> edges = { "::", "::1", "1::", "::ffff:0.0.0.0",
+                                "::ffff:0:0", "::0.0.1.0", "::1:0:0:0",
+                                "1:0:0:1::1", "1::1:0:0:1", "0:1::",
+                                "1:0:1:0:1:0:1:0", "ffff:ffff:ffff:ffff::",
+                                "::ffff:1.2.3.4", "::1.2.3.4",
+                                "64:ff9b::1.2.3.4", "fe80::1:0:0:0:0" };
+  for (auto text : edges) {
+    struct in6_addr in6;
+    inet_pton(AF_INET6, text, &in6);
+    failures += check(in6);
+  }
+
+  int mismatches = 0;
+  for (int i=0; i<TEST_ADDRS; i++)
+    mismatches += check(random_addr(rng));
+  cout << "random addresses: " << mismatches << " mismatches" << endl;
+  failures += mismatches;
+
+  // scoped addresses carry the name of their interface, printed or not
+  char name[IFNAMSIZ];
+  struct in6_addr in6;
+  inet_pton(AF_INET6, "fe80::1", &in6);
+  string expected = if_indextoname(1, name) ? string("fe80::1%") + name :
+                                              string("fe80::1");
+  for (int i=0; i<3; i++) {
+    string text = AddressValue(in6, 1).print();
+    if (text != expected) {
+      cout << "  zone: \"" << text << "\", expected " << expected << endl;
+      failures++;
+    }
+  }
+  cout << "zone: " << expected << endl;
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+
+  return failures ? 1 : 0;
+}
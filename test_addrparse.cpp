@@ -0,0 +1,156 @@
+// Checks AddressValue::parse() on literals it must accept or reject, and
+// that getaddrinfo(AI_NUMERICHOST), the former path, agrees on each one
+
+#include <netdb.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <iostream>
+#include <string>
+
+#include "address.h"
+
+using namespace std;
+
+typedef struct {
+  const char* literal;
+  int         family;
+  const char* expected;            // text of the address, nullptr to reject
+} parse_case_t;
+
+static const parse_case_t cases[] = {
+  // dotted quads
+  { "192.168.1.20",          AF_UNSPEC, "192.168.1.20" },
+  { "0.0.0.0",               AF_UNSPEC, "0.0.0.0" },
+  { "255.255.255.255",       AF_INET,   "255.255.255.255" },
+  { "192.168.1.20",          AF_INET6,  nullptr },
+  // leading zeros are octal, as inet_aton() takes them
+  { "010.0.0.1",             AF_UNSPEC, "8.0.0.1" },
+  { "00.0.0.01",             AF_UNSPEC, "0.0.0.1" },
+  { "0377.0.0.1",            AF_UNSPEC, "255.0.0.1" },
+  { "09.0.0.1",              AF_UNSPEC, nullptr },
+  { "0x7f.1",                AF_UNSPEC, "127.0.0.1" },
+  { "0x.0.0.1",              AF_UNSPEC, nullptr },
+  // short forms
+  { "10.1",                  AF_UNSPEC, "10.0.0.1" },
+  { "10.1.2",                AF_UNSPEC, "10.1.0.2" },
+  { "3232235796",            AF_UNSPEC, "192.168.1.20" },
+  // octets > 255
+  { "256.0.0.1",             AF_UNSPEC, nullptr },
+  { "1.2.3.256",             AF_UNSPEC, nullptr },
+  { "1.2.3.1000",            AF_UNSPEC, nullptr },
+  { "1.2.65536",             AF_UNSPEC, nullptr },
+  { "1.16777216",            AF_UNSPEC, nullptr },
+  { "4294967296",            AF_UNSPEC, nullptr },
+  { "0400.0.0.1",            AF_UNSPEC, nullptr },
+  // separators
+  { "1.2.3.4.5",             AF_UNSPEC, nullptr },
+  { "1..2.3",                AF_UNSPEC, nullptr },
+  { ".1.2.3",                AF_UNSPEC, nullptr },
+  { "1.2.3.",                AF_UNSPEC, nullptr },
+  // "::" placement
+  { "::",                    AF_UNSPEC, "::" },
+  { "::1",                   AF_UNSPEC, "::1" },
+  { "1::",                   AF_UNSPEC, "1::" },
+  { "1::2",                  AF_UNSPEC, "1::2" },
+  { "1:2:3:4:5:6:7::",       AF_UNSPEC, "1:2:3:4:5:6:7:0" },
+  { "::2:3:4:5:6:7:8",       AF_UNSPEC, "0:2:3:4:5:6:7:8" },
+  { "1:2:3:4:5:6:7:8",       AF_UNSPEC, "1:2:3:4:5:6:7:8" },
+  { ":::",                   AF_UNSPEC, nullptr },
+  { "1::2::3",               AF_UNSPEC, nullptr },
+  { ":1::2",                 AF_UNSPEC, nullptr },
+  { "1::2:",                 AF_UNSPEC, nullptr },
+  { "1:2:3:4:5:6:7:8::",     AF_UNSPEC, nullptr },
+  { "::1:2:3:4:5:6:7:8",     AF_UNSPEC, nullptr },
+  { "1:2:3:4:5:6:7",         AF_UNSPEC, nullptr },
+  { "1:2:3:4:5:6:7:8:9",     AF_UNSPEC, nullptr },
+  { "12345::1",              AF_UNSPEC, nullptr },
+  { "::1",                   AF_INET,   nullptr },
+  // embedded IPv4
+  { "::ffff:1.2.3.4",        AF_UNSPEC, "::ffff:1.2.3.4" },
+  { "::ffff:1.2.3.4",        AF_INET,   "1.2.3.4" },
+  { "64:ff9b::1.2.3.4",      AF_UNSPEC, "64:ff9b::102:304" },
+  { "1:2:3:4:5:6:1.2.3.4",   AF_UNSPEC, "1:2:3:4:5:6:102:304" },
+  { "1:2:3:4:5:6:7:1.2.3.4", AF_UNSPEC, nullptr },
+  { "::ffff:1.2.3",          AF_UNSPEC, nullptr },
+  { "::ffff:1.2.3.256",      AF_UNSPEC, nullptr },
+  { "::ffff:01.2.3.4",       AF_UNSPEC, nullptr },
+  { "::ffff:0x1.2.3.4",      AF_UNSPEC, nullptr },
+  { "::1.2.3.4:1",           AF_UNSPEC, nullptr },
+  // zones
+  { "fe80::1%1",             AF_UNSPEC, "fe80::1" },
+  { "fe80::1%",              AF_UNSPEC, nullptr },
+  { "fe80::1%nosuchif0",     AF_UNSPEC, nullptr },
+  { "fe80::1%1%1",           AF_UNSPEC, nullptr },
+  { "1.2.3.4%1",             AF_UNSPEC, nullptr },
+  // trailing garbage
+  { "1.2.3.4x",              AF_UNSPEC, nullptr },
+  { "1.2.3.4 ",              AF_UNSPEC, nullptr },
+  { "10.1x",                 AF_UNSPEC, nullptr },
+  { "::1 ",                  AF_UNSPEC, nullptr },
+  { "::1g",                  AF_UNSPEC, nullptr },
+  { "1::2/64",               AF_UNSPEC, nullptr },
+  { "",                      AF_UNSPEC, nullptr },
+  { "localhost",             AF_UNSPEC, nullptr },
+};
+
+static bool parse_getaddrinfo(const char* literal, int family,
+                              AddressValue& addr) {
+  struct addrinfo  hints;
+  struct addrinfo* res;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_flags    = AI_NUMERICHOST;
+  hints.ai_family   = family;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  if (getaddrinfo(literal, nullptr, &hints, &res) != 0)
+    return false;
+  addr = AddressValue::from_sockaddr(res->ai_addr);
+  freeaddrinfo(res);
+
+  return true;
+}
+
+static const char* family_name(int family) {
+  return family == AF_INET ? "AF_INET" :
+         family == AF_INET6 ? "AF_INET6" : "AF_UNSPEC";
+}
+
+int main() {
+  int failures = 0;
+  int accepted = 0;
+
+  for (const parse_case_t& c : cases) {
+    AddressValue addr;
+    AddressValue former;
+    bool ok = AddressValue::parse(c.literal, strlen(c.literal), c.family,
+                                  addr);
+    bool former_ok = parse_getaddrinfo(c.literal, c.family, former);
+    // the zone is checked apart: its name depends on the host
+    string text = ok ? addr.print() : "";
+    size_t zone = text.find('%');
+    if (zone != string::npos)
+      text.resize(zone);
+
+    bool good = c.expected ? ok and text == c.expected : not ok;
+    if (ok and strchr(c.literal, '%') and addr.get_scope_id() != 1)
+      good = false;
+    if (ok != former_ok or (ok and addr != former))
+      good = false;
+    if (not good) {
+      cout << "  \"" << c.literal << "\" " << family_name(c.family) << ": "
+           << (ok ? text : "rejected") << ", expected "
+           << (c.expected ? c.expected : "rejected") << ", getaddrinfo "
+           << (former_ok ? former.print() : "rejected") << endl;
+      failures++;
+    }
+    accepted += ok;
+  }
+  cout << sizeof(cases) / sizeof(cases[0]) << " literals, " << accepted
+       << " accepted, " << failures << " wrong" << endl;
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,150 @@
+// Drives the control socket as 'logctl' does: levels are changed and
+// counters read through it. Also checks that a stale socket is replaced
+// and that any other file at the socket path is left alone
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "logcontrol.h"
+#include "logging.h"
+
+using namespace std;
+
+#define TEST_SOCKET  "logcontrol.sock"
+#define TEST_FILE    "logcontrol.log"
+
+// one command on a fresh connection. Returns the reply, status included
+static string command(const string& line) {
+  struct sockaddr_un addr;
+  string reply;
+  char   buf[CONTROL_LINE_SIZE];
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, TEST_SOCKET);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 or connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+    if (fd >= 0)
+      close(fd);
+    return "error: cannot connect";
+  }
+
+  string request = line + "\n";
+  if (write(fd, request.data(), request.size()) < 0)
+    reply = "error: cannot send";
+  shutdown(fd, SHUT_WR);
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    reply.append(buf, n);
+  close(fd);
+
+  return reply;
+}
+
+static bool ends_with(const string& s, const string& end) {
+  return s.size() >= end.size() and
+         s.compare(s.size() - end.size(), end.size(), end) == 0;
+}
+
+// counters of 'module' in a stats reply
+static bool stats_of(const string& reply, const string& module,
+                     unsigned long& records, unsigned long& filtered) {
+  istringstream lines(reply);
+  string        line;
+
+  while (getline(lines, line)) {
+    istringstream words(line);
+    string        name;
+    unsigned long bytes;
+    if (words >> name >> records >> bytes >> filtered and name == module)
+      return true;
+  }
+
+  return false;
+}
+
+int main() {
+  int failures = 0;
+
+  logptr_t logger = Logger::get_logger("TCTL", WARNING, DEVNULL);
+  logger->set_logfile(TEST_FILE);
+
+  // a regular file where the socket goes is not removed
+  unlink(TEST_SOCKET);
+  close(open(TEST_SOCKET, O_WRONLY | O_CREAT, 0600));
+  bool started = Logger::start_control(TEST_SOCKET);
+  bool kept    = access(TEST_SOCKET, F_OK) == 0;
+  cout << "regular file: " << (started ? "replaced" : "refused") << endl;
+  if (started or not kept)
+    failures++;
+  Logger::stop_control();
+  unlink(TEST_SOCKET);
+
+  // a stale socket is
+  int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, TEST_SOCKET);
+  bind(stale, (struct sockaddr*) &addr, sizeof(addr));
+  close(stale);
+  started = Logger::start_control(TEST_SOCKET);
+  cout << "stale socket: " << (started ? "replaced" : "refused") << endl;
+  if (not started) {
+    cout << "FAILED" << endl;
+    return 1;
+  }
+
+  // set-level
+  string reply = command("level TCTL debug");
+  cout << "level TCTL debug: " << reply;
+  if (reply != "ok\n" or logger->get_loglevel() != DEBUG)
+    failures++;
+  reply = command("level TCTL loud");
+  cout << "level TCTL loud: " << reply;
+  if (reply.compare(0, 7, "error: ") != 0)
+    failures++;
+  reply = command("level NOSUCH debug");
+  cout << "level NOSUCH debug: " << reply;
+  if (reply.compare(0, 7, "error: ") != 0)
+    failures++;
+
+  // stats
+  reply  = command("level TCTL warning");
+  reply += command("stats filtered on");
+  for (int i=0; i<3; i++) {
+    logger->warning("written %d", i);
+    logger->debug("filtered %d", i);
+  }
+  reply += command("stats filtered off");
+  logger->debug("not counted");
+  if (reply != "ok\nok\nok\n")
+    failures++;
+
+  reply = command("stats");
+  unsigned long records = 0, filtered = 0;
+  bool found = stats_of(reply, "TCTL", records, filtered);
+  cout << "stats TCTL: " << records << " records, " << filtered
+       << " filtered" << endl;
+  // the level changes are audited in the logger's own file
+  if (not found or not ends_with(reply, "ok\n") or records < 3 or
+      filtered != 3)
+    failures++;
+
+  Logger::stop_control();
+  cout << "socket removed: " << (access(TEST_SOCKET, F_OK) != 0) << endl;
+  if (access(TEST_SOCKET, F_OK) == 0)
+    failures++;
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+
+  return failures ? 1 : 0;
+}
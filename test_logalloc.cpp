@@ -0,0 +1,96 @@
+// Checks that logging does not allocate memory once a thread is warmed up
+// and that long records are not truncated
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "logging.h"
+
+using namespace std;
+
+// count every allocation made through operator new
+static atomic<unsigned long> allocations(0);
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = malloc(size);
+  if (not p)
+    throw bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+#define WARMUP_RECORDS  100
+#define TEST_RECORDS    10000
+#define LONG_MESSAGE    1000
+
+// log a mix of emitted and filtered records. Returns allocations made
+static unsigned long log_records(logptr_t logger, logptr_t filtered,
+                                 const string& text, int count) {
+  unsigned long before = allocations;
+
+  for (int i=0; i<count; i++) {
+    logger->info("record %d: %s", i, text.c_str());
+    logger->warning("short record %d", i);
+    filtered->debug("filtered record %d", i);
+  }
+
+  return allocations - before;
+}
+
+int main() {
+  int failures = 0;
+
+  logptr_t logger   = Logger::get_logger("TALLOC", INFO, DEVNULL);
+  logptr_t filtered = Logger::get_logger("TALLOC.FILTERED", INFO, DEVNULL);
+  logger->set_logfile("/dev/null");
+
+  string text(LONG_MESSAGE, 'x');
+
+  // main thread
+  log_records(logger, filtered, text, WARMUP_RECORDS);
+  unsigned long allocs = log_records(logger, filtered, text, TEST_RECORDS);
+  cout << "main thread: " << allocs << " allocations for "
+       << 3 * TEST_RECORDS << " records" << endl;
+  if (allocs != 0)
+    failures++;
+
+  // a secondary thread (records carry a thread tag)
+  thread worker([&]() {
+    log_records(logger, filtered, text, WARMUP_RECORDS);
+    allocs = log_records(logger, filtered, text, TEST_RECORDS);
+  });
+  worker.join();
+  cout << "worker thread: " << allocs << " allocations for "
+       << 3 * TEST_RECORDS << " records" << endl;
+  if (allocs != 0)
+    failures++;
+
+  // long records are written in full
+  logger->set_logfile("logalloc.log");
+  logger->error("%s", text.c_str());
+  logger->set_logfile("");
+
+  ifstream ifs("logalloc.log");
+  string line, last;
+  while (getline(ifs, line))
+    last = line;
+  bool complete = last.size() > text.size() and
+                  last.compare(last.size() - text.size(), text.size(), text) == 0;
+  cout << "long record: " << (complete ? "complete" : "truncated") << endl;
+  if (not complete)
+    failures++;
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,85 @@
+// Logs from several threads in asynchronous mode through a small queue
+// that blocks when full. Once stop_async() returns, every record must be
+// in the log file, those of each thread in the order they were logged
+
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logging.h"
+
+using namespace std;
+
+#define TEST_FILE     "logasync.log"
+#define TEST_THREADS  4
+#define TEST_RECORDS  20000                  // per thread
+#define TEST_QUEUE    64
+
+static void producer(logptr_t logger, int id) {
+
+  for (int i=0; i<TEST_RECORDS; i++)
+    logger->info("thread %d record %d", id, i);
+}
+
+int main() {
+  int failures = 0;
+
+  remove(TEST_FILE);
+  logptr_t logger = Logger::get_logger("TASYNC", INFO, DEVNULL);
+  logger->set_logfile(TEST_FILE);
+  // no batching: records are in the file once the writer has taken them
+  logger->set_batching(0, 0);
+
+  if (not Logger::start_async(TEST_QUEUE, OVF_BLOCK)) {
+    cout << "cannot start asynchronous mode" << endl;
+    cout << "FAILED" << endl;
+    return 1;
+  }
+  vector<thread> threads;
+  for (int id=0; id<TEST_THREADS; id++)
+    threads.push_back(thread(producer, logger, id));
+  for (auto& t : threads)
+    t.join();
+  // no flush: stopping must write what is still queued
+  Logger::stop_async();
+
+  async_stats_t stats = Logger::get_async_stats();
+  cout << "queued " << stats.queued << ", written " << stats.written
+       << ", dropped " << stats.dropped_newest + stats.dropped_oldest << endl;
+  if (stats.queued != stats.written or stats.dropped_newest or
+      stats.dropped_oldest)
+    failures++;
+
+  ifstream in(TEST_FILE);
+  string   line;
+  int      next[TEST_THREADS] = { 0 };
+  int      disorders = 0;
+  while (getline(in, line)) {
+    size_t at = line.find("thread ");
+    int    id, record;
+    if (at == string::npos or
+        sscanf(line.c_str() + at, "thread %d record %d", &id, &record) != 2 or
+        id < 0 or id >= TEST_THREADS)
+      continue;
+    if (record != next[id] and disorders++ < 5)
+      cout << "  thread " << id << ": record " << record << ", expected "
+           << next[id] << endl;
+    next[id] = record + 1;
+  }
+  int lost = 0;
+  for (int id=0; id<TEST_THREADS; id++)
+    lost += TEST_RECORDS - next[id];
+  cout << TEST_THREADS << " threads, " << disorders << " out of order, "
+       << lost << " lost" << endl;
+  if (disorders or lost)
+    failures++;
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,165 @@
+// Logs the same calls as text, through LOG_BINARY and into the flight
+// recorder (filtered macro and direct calls), then decodes the binary log
+// and the flight recorder dump as logdecode does. Every decoded message
+// must read exactly as its text record, 64 bit and negative values with
+// plain, 'l' and 'll' conversions included
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "logbinary.h"
+#include "logging.h"
+
+using namespace std;
+
+#define TEST_FILE    "logbinary.log"
+#define TEST_BINLOG  "logbinary.bin"
+#define TEST_FLIGHT  "logbinary.flight"
+
+// messages of the records of a binary log, in file order
+static bool decode(const char* fname, vector<string>& messages) {
+  ifstream in(fname, ios::binary);
+  string   data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  binlog_header_t      header;
+  map<uint32_t,string> formats;
+
+  if (data.size() < sizeof(header))
+    return false;
+  memcpy(&header, data.data(), sizeof(header));
+  if (header.version != BINLOG_VERSION)
+    return false;
+
+  size_t offset = (header.header_size + 7) & ~((size_t) 7);
+  while (offset + sizeof(binlog_entry_t) <= data.size()) {
+    binlog_entry_t entry;
+    memcpy(&entry, data.data() + offset, sizeof(entry));
+    if (entry.size < sizeof(entry) or entry.size > data.size() - offset)
+      break;
+
+    const char* payload = data.data() + offset + sizeof(entry);
+    size_t      paylen  = entry.size - sizeof(entry);
+    char        message[LOG_RECORD_SIZE];
+    if (entry.type == BL_FORMAT)
+      formats[entry.id] = string(payload, strnlen(payload, paylen));
+    else if (entry.type == BL_RECORD) {
+      binlog_render(message, sizeof(message), formats[entry.id].c_str(),
+                    payload, paylen);
+      messages.push_back(message);
+    }
+    offset += entry.size;
+  }
+
+  return true;
+}
+
+// text, binary and flight recorder records of the same call. Debug calls
+// are filtered, so they only go to the flight recorder
+#define LOG_BOTH(logger, ...)                                        \
+  do {                                                               \
+    (logger)->info(__VA_ARGS__);                                     \
+    LOG_BINARY(logger, INFO, __VA_ARGS__);                           \
+    LOG_DEBUG(logger, __VA_ARGS__);                                  \
+    (logger)->debug(__VA_ARGS__);                                    \
+  } while (0)
+
+int main() {
+  int failures = 0;
+
+  remove(TEST_FILE);
+  remove(TEST_BINLOG);
+  remove(TEST_FLIGHT);
+  logptr_t logger = Logger::get_logger("TBIN", INFO, DEVNULL);
+  logger->set_logfile(TEST_FILE);
+  logger->set_batching(0, 0);
+  if (not Logger::open_binlog(TEST_BINLOG, 1 << 20) or
+      not Logger::start_flight_recorder(1024)) {
+    cout << "cannot open the binary log or start the flight recorder" << endl;
+    cout << "FAILED" << endl;
+    return 1;
+  }
+
+  // messages start with '#' to tell them from the notes of the logger
+  LOG_BOTH(logger, "#big %d sz %u hex %x", 5000000000L, (size_t) 4294967303,
+           -1LL);
+  LOG_BOTH(logger, "#long %ld %lu %lx %lo", -5000000000L, (size_t) -1,
+           (long) -2, 01234567012345670L);
+  LOG_BOTH(logger, "#long long %lld %llu %llx %lli", LLONG_MIN, ULLONG_MAX,
+           -2LL, -1LL);
+  LOG_BOTH(logger, "#plain %d %u %x %X %o %i", -7, -7, -1, 0xabcdef01u,
+           -8, (short) -1);
+  LOG_BOTH(logger, "#mixed %d %lu %lld", (size_t) -1, -1, (unsigned) -1);
+  LOG_BOTH(logger, "#narrow %hhd %hhu %hd %hu %hx", 300, -1, 70000, -1,
+           (long long) 0x123456789);
+  LOG_BOTH(logger, "#widths %5d|%-8lx|%08llu|%+d|% ld", -42L, 255UL,
+           12345LL, 5000000000LL, (size_t) 3);
+  LOG_BOTH(logger, "#star %*d|%-*.*s|%.*f", 6, 42L, 8, 2, "xyz", 3, 2.5);
+  LOG_BOTH(logger, "#chars %c%c %d %u %d", 'o', 'k', true, (unsigned char) 200,
+           (signed char) -3);
+  LOG_BOTH(logger, "#others %s %.3s %p %g %e", "str", string("abcdef"),
+           (void*) 0x1234, 1.5f, -2e300);
+
+  Logger::close_binlog();
+  bool dumped = Logger::dump_flight_recorder(TEST_FLIGHT);
+  Logger::stop_flight_recorder();
+
+  vector<string> text;
+  ifstream in(TEST_FILE);
+  string   line;
+  while (getline(in, line)) {
+    size_t at = line.find("] #");
+    if (at != string::npos)
+      text.push_back(line.substr(at + 2));
+  }
+
+  vector<string> binary;
+  vector<string> flight;
+  if (not decode(TEST_BINLOG, binary) or not dumped or
+      not decode(TEST_FLIGHT, flight)) {
+    cout << "cannot decode " << TEST_BINLOG << " or " << TEST_FLIGHT << endl;
+    failures++;
+  }
+  // the flight recorder keeps every copy of a call, in call order: the
+  // text one and the filtered macro and direct ones
+  vector<string> calls;
+  for (auto& message : flight)
+    if (message[0] == '#')
+      calls.push_back(message);
+  size_t copies = text.empty() ? 0 : calls.size() / text.size();
+
+  struct {
+    const char*     name;
+    vector<string>& messages;
+    size_t          copies;
+  } decoded[] = { { "binary", binary, 1 }, { "flight", calls, copies } };
+  for (auto& d : decoded) {
+    int wrong = 0;
+    if (d.copies < 1 or d.messages.size() != d.copies * text.size()) {
+      cout << d.name << ": " << d.messages.size() << " records for "
+           << text.size() << " calls" << endl;
+      failures++;
+    }
+    for (size_t i=0; i<d.messages.size(); i++)
+      if (d.messages[i] != text[i / d.copies]) {
+        cout << "  " << d.name << ": \"" << d.messages[i] << "\"" << endl
+             << "  text: \"" << text[i / d.copies] << "\"" << endl;
+        wrong++;
+      }
+    cout << d.name << ": " << wrong << " of " << d.messages.size()
+         << " differ" << endl;
+    failures += wrong;
+  }
+  for (auto& message : text)
+    cout << "  " << message << endl;
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,66 @@
+// Checks the formatting of log messages, including calls whose arguments
+// do not fit their conversions (possible with direct calls, which are not
+// checked at compile time) and conversion specs too long for the formatter
+
+#include <iostream>
+#include <string>
+
+#include "logformat.h"
+
+using namespace std;
+
+template <typename... Args>
+static int check(const string& expected, const char* format,
+                 const Args&... args) {
+  log_value_t values[sizeof...(Args) + 1] = { log_value(args)... };
+  char        text[256];
+
+  log_format(text, sizeof(text), format, values, sizeof...(Args));
+  if (text == expected)
+    return 0;
+
+  cout << "  \"" << format << "\": \"" << text << "\", expected \""
+       << expected << "\"" << endl;
+  return 1;
+}
+
+int main() {
+  int failures = 0;
+
+  // matching arguments
+  failures += check("42 -7 ff 17 x", "%d %i %x %o %c", 42, -7, 255u, 15, 'x');
+  failures += check("   42|ab  |1.50|0x10", "%5d|%-4s|%.2f|%p", 42, "ab", 1.5,
+                    (void*) 0x10);
+  failures += check("-1 255", "%hhd %hhu", -1, 255);
+  failures += check("042     |", "%------8.*d|", 3, 42);
+
+  // mismatches are shown with the argument, snprintf never sees them
+  failures += check("%!s(int=42)", "%s", 42);
+  failures += check("%!f(int=-42)", "%f", -42);
+  failures += check("%!p(int=42)", "%p", 42);
+  failures += check("%!n(int=42)", "%n", 42);
+  failures += check("%!s(int=42)", "%-10s", 42);
+  failures += check("%!d(string=abc)", "%d", "abc");
+  failures += check("%!p(string=abc)", "%p", string("abc"));
+  failures += check("%!n(string=abc)", "%n", "abc");
+  failures += check("%!d(float=1.5)", "%d", 1.5);
+  failures += check("%!s(float=1.5)", "%s", 1.5);
+  failures += check("%!x(pointer=0x10)", "%x", (void*) 0x10);
+  failures += check("%!s(pointer=0x10)", "%s", (void*) 0x10);
+  failures += check("%!y(int=1) 2", "%y %d", 1, 2);
+
+  // specs longer than the formatter keeps are cut short, not overrun
+  string digits(100, '9');
+  string format = "%" + digits + "." + digits + "d|%-" + digits + ".*s|";
+  log_value_t values[] = { log_value(42), log_value(7), log_value("abc") };
+  char        text[256];
+  log_format(text, sizeof(text), format.c_str(), values, 3);
+  string out(text);
+  cout << "long specs: \"" << out.substr(0, 40) << "\"" << endl;
+  if (out.empty() or out.back() != '|')
+    failures++;
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,165 @@
+// Checks that every line of a JSON log file is a JSON object, including
+// the records of loggers created after the JSON file was set on their
+// ancestor, and messages with characters that need escaping
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "logging.h"
+
+using namespace std;
+
+#define TEST_FILE     "logjson.log"
+#define TEST_RECORDS  100
+
+// minimal JSON checker: advances 'p' past one value, false if malformed
+static bool json_value(const char*& p);
+
+static void json_space(const char*& p) {
+  while (*p == ' ' or *p == '\t')
+    p++;
+}
+
+static bool json_string(const char*& p) {
+  if (*p++ != '"')
+    return false;
+  while (*p != '"') {
+    if ((unsigned char) *p < 0x20)
+      return false;
+    if (*p++ != '\\')
+      continue;
+    if (*p == 'u') {
+      for (int i=1; i<=4; i++)
+        if (not isxdigit((unsigned char) p[i]))
+          return false;
+      p += 5;
+    }
+    else if (*p and strchr("\"\\/bfnrt", *p))
+      p++;
+    else
+      return false;
+  }
+  p++;
+  return true;
+}
+
+static bool json_number(const char*& p) {
+  const char* start = p;
+  strtod(p, (char**) &p);
+  return p != start;
+}
+
+static bool json_object(const char*& p) {
+  p++;
+  json_space(p);
+  if (*p == '}') {
+    p++;
+    return true;
+  }
+  for (;;) {
+    json_space(p);
+    if (not json_string(p))
+      return false;
+    json_space(p);
+    if (*p++ != ':' or not json_value(p))
+      return false;
+    json_space(p);
+    if (*p == '}') {
+      p++;
+      return true;
+    }
+    if (*p++ != ',')
+      return false;
+  }
+}
+
+static bool json_array(const char*& p) {
+  p++;
+  json_space(p);
+  if (*p == ']') {
+    p++;
+    return true;
+  }
+  for (;;) {
+    if (not json_value(p))
+      return false;
+    json_space(p);
+    if (*p == ']') {
+      p++;
+      return true;
+    }
+    if (*p++ != ',')
+      return false;
+  }
+}
+
+static bool json_value(const char*& p) {
+  json_space(p);
+  switch (*p) {
+    case '{':
+      return json_object(p);
+    case '[':
+      return json_array(p);
+    case '"':
+      return json_string(p);
+  }
+  for (const char* word : { "true", "false", "null" })
+    if (strncmp(p, word, strlen(word)) == 0) {
+      p += strlen(word);
+      return true;
+    }
+  return json_number(p);
+}
+
+static bool json_line(const string& line) {
+  const char* p = line.c_str();
+
+  json_space(p);
+  if (*p != '{' or not json_object(p))
+    return false;
+  json_space(p);
+  return *p == '\0';
+}
+
+int main() {
+  int failures = 0;
+
+  remove(TEST_FILE);
+  logptr_t parent = Logger::get_logger("TJSON", INFO, DEVNULL);
+  parent->set_format(SINK_JSON);
+  parent->set_logfile(TEST_FILE);
+  parent->info("parent record");
+
+  // created after the JSON file was set on its parent
+  logptr_t child = Logger::get_logger("TJSON.CHILD");
+  logptr_t grandchild = Logger::get_logger("TJSON.CHILD.LEAF");
+  for (int i=0; i<TEST_RECORDS; i++) {
+    child->info("child record %d: \"quoted\" back\\slash\ttab", i);
+    grandchild->warning("grandchild record %d %s", i, string("a\nb"));
+  }
+  parent->flush();
+  child->flush();
+  grandchild->flush();
+
+  ifstream in(TEST_FILE);
+  string   line;
+  int      lines = 0;
+  while (getline(in, line)) {
+    lines++;
+    if (not json_line(line) and failures++ < 5)
+      cout << "  not JSON: " << line << endl;
+  }
+  cout << lines << " lines, " << failures << " not JSON" << endl;
+  // plus the notes of the logger creations
+  if (lines < 2 * TEST_RECORDS + 1)
+    failures++;
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+
+  return failures ? 1 : 0;
+}
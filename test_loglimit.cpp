@@ -0,0 +1,83 @@
+// Drives a rate limiter with a made up clock: a burst is let through, the
+// records after it are dropped, and the first record admitted once the
+// bucket refills reports how many were
+
+#include <iostream>
+
+#include "loglimit.h"
+
+using namespace std;
+
+#define TEST_COUNT   5                       // records per period
+#define TEST_MSECS   1000
+#define TEST_BURST   10
+#define TEST_EXTRA   7                       // records beyond the burst
+
+#define MSEC  1000000LL                      // in nsecs
+
+// admitted records of 'calls' at 'now'. 'dropped' gets the report of the
+// first one
+static int admit(LogRateLimiter& limiter, int calls, long long now,
+                 unsigned long& dropped) {
+  int admitted = 0;
+
+  for (int i=0; i<calls; i++) {
+    unsigned long count = 0;
+    if (limiter.admit(count, now) and admitted++ == 0)
+      dropped = count;
+  }
+
+  return admitted;
+}
+
+int main() {
+  int           failures = 0;
+  long long     now      = 1000 * MSEC;
+  unsigned long dropped  = 0;
+
+  LogRateLimiter limiter(TEST_COUNT, TEST_MSECS, TEST_BURST);
+
+  // a full bucket lets the whole burst through, then drops
+  int admitted = admit(limiter, TEST_BURST + TEST_EXTRA, now, dropped);
+  cout << "burst: " << admitted << " of " << TEST_BURST + TEST_EXTRA
+       << " admitted, " << dropped << " reported" << endl;
+  if (admitted != TEST_BURST or dropped != 0)
+    failures++;
+
+  // still empty a bit before a token is due
+  now += TEST_MSECS / TEST_COUNT * MSEC - 1;
+  admitted = admit(limiter, 3, now, dropped);
+  cout << "before refill: " << admitted << " admitted" << endl;
+  if (admitted != 0)
+    failures++;
+
+  // one token later, one record goes and reports all that were dropped
+  now += 1;
+  admitted = admit(limiter, 2, now, dropped);
+  cout << "after refill: " << admitted << " admitted, " << dropped
+       << " reported" << endl;
+  if (admitted != 1 or dropped != TEST_EXTRA + 3)
+    failures++;
+
+  // a whole idle period refills 'count' tokens. The count starts over
+  now += TEST_MSECS * MSEC;
+  admitted = admit(limiter, TEST_COUNT + 1, now, dropped);
+  cout << "after a period: " << admitted << " admitted, " << dropped
+       << " reported" << endl;
+  if (admitted != TEST_COUNT or dropped != 1)
+    failures++;
+
+  // the rate over a long run is 'count' per 'msecs', whatever the calls
+  int total = 0;
+  for (int tick=0; tick<100; tick++) {
+    now += TEST_MSECS / 10 * MSEC;
+    total += admit(limiter, 50, now, dropped);
+  }
+  cout << "10 periods: " << total << " admitted" << endl;
+  if (total != 10 * TEST_COUNT)
+    failures++;
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,110 @@
+// Rotates a file sink every few KB while a thread writes to it. The
+// rotated files, read from the oldest to the current one, must hold every
+// record once, in order and whole
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "logsink.h"
+
+using namespace std;
+
+#define TEST_FILE     "logrotate.log"
+#define TEST_BYTES    4096                   // rotation size
+#define TEST_KEEP     500                    // more than the rotations
+#define TEST_RECORDS  50000
+
+static void remove_files() {
+
+  remove(TEST_FILE);
+  for (int i=1; i<=TEST_KEEP; i++)
+    remove((string(TEST_FILE) + '.' + to_string(i)).c_str());
+}
+
+static void writer(shared_ptr<FdSink> sink, atomic<bool>* done) {
+  char record[64];
+
+  for (int i=0; i<TEST_RECORDS; i++) {
+    int len = snprintf(record, sizeof(record), "record %d of %d", i,
+                       TEST_RECORDS);
+    sink->write(record, len, i % 100 == 0 ? 5 : 1);
+  }
+  sink->flush();
+  *done = true;
+}
+
+int main() {
+  int failures = 0;
+
+  remove_files();
+  shared_ptr<FdSink> sink = FdSink::open_file(TEST_FILE, 5);
+  if (not sink) {
+    cout << "cannot open " << TEST_FILE << endl;
+    cout << "FAILED" << endl;
+    return 1;
+  }
+  sink->set_batching(512, 1000, 5);
+  sink->set_rotation(TEST_BYTES, 0, TEST_KEEP);
+
+  // rotate as the flusher thread would, only much more often
+  atomic<bool> done(false);
+  thread       t(writer, sink, &done);
+  while (not done) {
+    sink->rotate_expired(mono_msecs());
+    usleep(100);
+  }
+  t.join();
+  sink.reset();
+
+  // the oldest file has the highest number
+  int files = 0;
+  while (files < TEST_KEEP and
+         access((string(TEST_FILE) + '.' + to_string(files + 1)).c_str(),
+                F_OK) == 0)
+    files++;
+  bool named = access((string(TEST_FILE) + '.' + to_string(files + 1)).c_str(),
+                      F_OK) != 0 and access(TEST_FILE, F_OK) == 0;
+
+  int    next = 0;
+  int    bad  = 0;
+  for (int i=files; i>=0; i--) {
+    string   name = i ? string(TEST_FILE) + '.' + to_string(i) : TEST_FILE;
+    ifstream in(name);
+    string   content((istreambuf_iterator<char>(in)),
+                     istreambuf_iterator<char>());
+    size_t   start = 0;
+    // a record split across files would leave a partial line
+    if (not content.empty() and content.back() != '\n' and bad++ < 5)
+      cout << "  " << name << ": ends inside a record" << endl;
+    while (start < content.size()) {
+      size_t end = content.find('\n', start);
+      if (end == string::npos)
+        break;
+      string line = content.substr(start, end - start);
+      string expected = "record " + to_string(next) + " of " +
+                        to_string(TEST_RECORDS);
+      if (line != expected and bad++ < 5)
+        cout << "  " << name << ": \"" << line << "\", expected \""
+             << expected << "\"" << endl;
+      next++;
+      start = end + 1;
+    }
+  }
+  cout << files << " rotated files, " << next << " records, " << bad
+       << " wrong" << endl;
+  if (files < 2 or files == TEST_KEEP or not named or bad or
+      next != TEST_RECORDS)
+    failures++;
+  remove_files();
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+
+  return failures ? 1 : 0;
+}
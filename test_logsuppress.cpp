@@ -0,0 +1,105 @@
+// Checks repeated message suppression: repeats within the window are not
+// written, and the next different message, the next repeat after the
+// window, turning suppression off, the end of the window with nothing
+// logged or the destruction of the logger reports them as "last message
+// repeated N times"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "logging.h"
+
+using namespace std;
+
+#define TEST_FILE    "logsuppress.log"
+#define TEST_WINDOW  60000                   // msecs, never reached
+#define TEST_SHORT   50
+
+int main() {
+  int failures = 0;
+
+  remove(TEST_FILE);
+  logptr_t logger = Logger::get_logger("TSUPP", INFO, DEVNULL);
+  logger->set_logfile(TEST_FILE);
+  logger->set_batching(0, 0);
+  logger->set_suppression(TEST_WINDOW);
+
+  // repeats, ended by a different message
+  for (int i=0; i<5; i++)
+    logger->info("link %s down", "eth0");
+  logger->info("link %s up", "eth0");
+  // the level is part of the message
+  logger->info("link %s up", "eth0");
+  logger->warning("link %s up", "eth0");
+  // repeats, ended by turning suppression off
+  for (int i=0; i<3; i++)
+    logger->warning("link %s up", "eth0");
+  logger->set_suppression(0);
+  logger->warning("link %s up", "eth0");
+  // repeats, ended by the window
+  logger->set_suppression(TEST_SHORT);
+  for (int i=0; i<3; i++)
+    logger->info("tick");
+  usleep(2 * TEST_SHORT * 1000);
+  logger->info("tick");
+  // a burst followed by nothing, reported by the flusher thread
+  for (int i=0; i<5; i++)
+    logger->info("burst");
+  usleep(4 * TEST_SHORT * 1000);
+  // repeats pending when a logger goes away
+  {
+    logptr_t child = Logger::get_logger("TSUPP.GONE");
+    child->set_suppression(TEST_WINDOW);
+    for (int i=0; i<3; i++)
+      child->warning("going");
+  }
+  logger->flush();
+
+  // repeats are reported at their own level
+  vector<string> expected = {
+    "[info] link eth0 down",
+    "[info] last message repeated 4 times",
+    "[info] link eth0 up",
+    "[info] last message repeated 1 times",
+    "[warning] link eth0 up",
+    "[warning] last message repeated 3 times",
+    "[warning] link eth0 up",
+    "[info] tick",
+    "[info] last message repeated 2 times",
+    "[info] tick",
+    "[info] burst",
+    "[info] last message repeated 4 times",
+    "[warning] going",
+    "[warning] last message repeated 2 times",
+  };
+  ifstream in(TEST_FILE);
+  string   line;
+  size_t   n = 0;
+  while (getline(in, line)) {
+    // records start with the time, level and logger name
+    if (line.find("TSUPP") == string::npos or
+        line.find("created new logging instance") != string::npos)
+      continue;
+    string want = n < expected.size() ? expected[n] : "(nothing)";
+    bool   good = line.size() >= want.size() and
+                  line.compare(line.size() - want.size(), want.size(),
+                               want) == 0;
+    cout << (good ? "  " : "  wrong: ") << line << endl;
+    if (not good)
+      failures++;
+    n++;
+  }
+  if (n != expected.size()) {
+    cout << n << " records, expected " << expected.size() << endl;
+    failures++;
+  }
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+
+  return failures ? 1 : 0;
+}